@@ -0,0 +1,934 @@
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <cmath>
+#include <numeric>
+#include <condition_variable>
+
+#include "common.hpp"
+#include "delayEngine.hpp"
+#include "mapEngine.hpp"
+#include "threadPool.hpp"
+#include "sharedMemory.hpp"
+#include "awsClient.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const int SIZES[] = { 1, 10, 100, 1000 };
+const Timestamp_t MEASURE_MICROSECONDS = 200000; // time spent on each case
+const int DEFAULT_GENERATED_VERTICES = 200000;
+const int DEFAULT_GENERATED_DEGREE = 8;
+const int DEFAULT_SOURCES = 5;
+const int DEFAULT_PAIRS = 1000;
+const int DEFAULT_HIERARCHY_VERTICES = 40000; // contraction takes seconds per 10000 vertices
+const int DEFAULT_ROUND_TRIPS = 20000;
+const char* BENCHMARK_PORTS[] = { "25943", "26943" }; // of the measuring end and of the echo end
+const int TRANSPORT_SIZES[] = { 64, 1024, 16384 };
+const int TRANSPORT_INFLIGHT_BYTES = 65536; // below the default UDP receive buffer, so that no datagram of the throughput case is dropped
+const int TRANSPORT_INFLIGHT_DATAGRAMS = 64; // the UDP receive buffer is also charged an overhead per datagram
+const double DEFAULT_REACTOR_SECONDS = 5;
+const int DEFAULT_REACTOR_CONNECTIONS = 64;
+const int REACTOR_START_MILLISECONDS = 500; // for main server to open the listeners of all its reactors
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+class EncodingMismatchException : public EE450Exception {
+public:
+	explicit EncodingMismatchException(const string& name) : EE450Exception(name + " encoding differs from legacy codec") {}
+};
+
+class DatagramLostException : public EE450Exception {
+public:
+	explicit DatagramLostException(const string& transport) : EE450Exception("Datagram lost over " + transport) {}
+};
+
+class ProcessStartException : public EE450Exception {
+public:
+	explicit ProcessStartException(const string& program) : EE450Exception("Cannot start " + program + ", run the benchmark next to it with its port free") {}
+};
+
+class ResultMismatchException : public EE450Exception {
+public:
+	explicit ResultMismatchException(const string& engine) : EE450Exception("Result of " + engine + " differs from Dijkstra") {}
+};
+
+// hardware cache misses of this thread in user space, unavailable when the kernel or hypervisor hides the counter
+class CacheMissCounter {
+private:
+	int fd = -1;
+
+public:
+	CacheMissCounter() {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	CacheMissCounter(const CacheMissCounter&) = delete;
+	CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+	~CacheMissCounter() {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	bool Available() const {
+		return fd >= 0;
+	}
+
+	void Start() {
+		if (fd >= 0) {
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	long long Stop() {
+		long long count = 0;
+		if (fd >= 0) {
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+				count = 0;
+			}
+		}
+		return count;
+	}
+};
+
+// in-memory socket, what is written can be read back
+class BufferSocketHelper : public SocketHelper {
+private:
+	vector<char> buffer;
+	size_t readIndex = 0;
+
+protected:
+	virtual void Read(char* buffer, const int size) {
+		if (readIndex + size > this->buffer.size()) {
+			throw PayloadSizeMismatchException();
+		}
+		memcpy(buffer, this->buffer.data() + readIndex, size);
+		readIndex += size;
+	}
+
+	virtual void Write(const char* buffer, const int size) {
+		auto offset = this->buffer.size();
+		this->buffer.resize(offset + size);
+		memcpy(this->buffer.data() + offset, buffer, size);
+	}
+
+public:
+	virtual void Flush() {}
+
+	void Rewind() {
+		readIndex = 0;
+	}
+
+	void Clear() {
+		buffer.clear();
+		readIndex = 0;
+	}
+
+	const vector<char>& Bytes() const {
+		return buffer;
+	}
+};
+
+// field by field codec through the virtual Read/Write, as messages were encoded before generated codecs
+struct LegacyCodec {
+	static void Encode(SocketHelper& socket, const AllShortestPath& message) {
+		socket.Write(message.requestId);
+		socket.Write(message.status);
+		socket.Write(message.mapInfo);
+		socket.Write(message.sourceNode);
+		int size = message.distances.size();
+		socket.Write(size);
+		for (const auto& p : message.distances) {
+			socket.Write(p.first);
+			socket.Write(p.second);
+		}
+		socket.Flush();
+	}
+
+	static void Decode(SocketHelper& socket, AllShortestPath& message) {
+		socket.Read(message.requestId);
+		socket.Read(message.status);
+		socket.Read(message.mapInfo);
+		socket.Read(message.sourceNode);
+		int size;
+		socket.Read(size);
+		message.distances.clear();
+		message.distances.reserve(size);
+		for (auto i = 0; i < size; i++) {
+			Node_t n;
+			socket.Read(n);
+			Distance_t d;
+			socket.Read(d);
+			message.AddDistance(n, d);
+		}
+	}
+
+	static void Encode(SocketHelper& socket, const AllDelay& message) {
+		socket.Write(message.requestId);
+		socket.Write(message.status);
+		int size = message.delays.size();
+		socket.Write(size);
+		for (const auto& d : message.delays) {
+			socket.Write(d.first);
+			socket.Write(d.second);
+		}
+		socket.Flush();
+	}
+
+	static void Decode(SocketHelper& socket, AllDelay& message) {
+		socket.Read(message.requestId);
+		socket.Read(message.status);
+		int size;
+		socket.Read(size);
+		message.delays.clear();
+		message.delays.reserve(size);
+		for (auto i = 0; i < size; i++) {
+			Node_t n;
+			socket.Read(n);
+			Delay d;
+			socket.Read(d);
+			message.delays.emplace_back(n, d);
+		}
+	}
+
+	static void Encode(SocketHelper& socket, const Response& message) {
+		socket.Write(message.status);
+		int size = message.values.size();
+		socket.Write(size);
+		for (const auto& v : message.values) {
+			socket.Write(v);
+		}
+		socket.Flush();
+	}
+
+	static void Decode(SocketHelper& socket, Response& message) {
+		socket.Read(message.status);
+		int size;
+		socket.Read(size);
+		message.values.clear();
+		message.values.reserve(size);
+		for (auto i = 0; i < size; i++) {
+			std::tuple<Node_t, Distance_t, Delay> t;
+			socket.Read(t);
+			message.values.push_back(t);
+		}
+	}
+};
+
+// codec generated from MESSAGE_FIELDS
+struct GeneratedCodec {
+	template <typename Message>
+	static void Encode(SocketHelper& socket, const Message& message) {
+		message.Encode(socket);
+	}
+
+	template <typename Message>
+	static void Decode(SocketHelper& socket, Message& message) {
+		DecodeFields(socket, message.Fields());
+	}
+};
+
+//===============================================//
+//                     Tool                      //
+//===============================================//
+
+// sample messages with size results
+struct Samples {
+	AllShortestPath path;
+	DefaultDelay delay;
+	Response response;
+
+	static AllShortestPath MakePath(const int size) {
+		AllShortestPath path(MapInfo('A', 200000, 1000000), 0);
+		path.requestId = 1;
+		for (auto i = 1; i <= size; i++) {
+			path.AddDistance(i, i * 7);
+		}
+		return path;
+	}
+
+	explicit Samples(const int size) : path(MakePath(size)), delay(8000, path), response(path, delay) {}
+};
+
+// run fn repeatedly for a while, return nanoseconds per call
+template <typename Function>
+double Measure(const Function& fn) {
+	long long count = 0;
+	auto start = NowMicroseconds();
+	auto batch = 64;
+	while (NowMicroseconds() - start < MEASURE_MICROSECONDS) {
+		for (auto i = 0; i < batch; i++) {
+			fn();
+		}
+		count += batch;
+	}
+	return (NowMicroseconds() - start) * 1000.0 / count;
+}
+
+template <typename Codec, typename Message>
+double MeasureEncode(BufferSocketHelper& socket, const Message& message) {
+	return Measure([&] {
+		socket.Clear();
+		Codec::Encode(socket, message);
+	});
+}
+
+template <typename Codec, typename Message>
+double MeasureDecode(BufferSocketHelper& socket, Message& message) {
+	return Measure([&] {
+		socket.Rewind();
+		Codec::Decode(socket, message);
+	});
+}
+
+// random connected map with sparse labels, weights in [1, 100]
+Map GenerateMap(const int vertices, const int degree, const unsigned seed) {
+	std::mt19937 random(seed);
+	auto map = Map(MapInfo('G', 200000, 1000000));
+	auto label = [](const int i) { return Node_t(i) * 7 + 3; };
+	auto weight = std::uniform_int_distribution<int>(1, 100);
+	for (auto i = 1; i < vertices; i++) { // spanning tree keeps every vertex reachable
+		map.AddUndirectedEdge(label(i), label(std::uniform_int_distribution<int>(0, i - 1)(random)), weight(random));
+	}
+	auto vertex = std::uniform_int_distribution<int>(0, vertices - 1);
+	for (long long i = 0; i < (long long)vertices * (degree / 2 - 1); i++) {
+		auto a = vertex(random);
+		auto b = vertex(random);
+		if (a != b) {
+			map.AddUndirectedEdge(label(a), label(b), weight(random));
+		}
+	}
+	map.Freeze();
+	return map;
+}
+
+// road-like map, a side x side grid with random diagonals, labels shuffled so label order has no locality; label of vertex i is labels[i]
+Map GenerateGridMap(const int side, const unsigned seed, vector<Node_t>& labels) {
+	std::mt19937 random(seed);
+	auto map = Map(MapInfo('G', 200000, 1000000));
+	labels.resize(side * side);
+	for (size_t i = 0; i < labels.size(); i++) {
+		labels[i] = Node_t(i) * 7 + 3;
+	}
+	std::shuffle(labels.begin(), labels.end(), random);
+	auto weight = std::uniform_int_distribution<int>(1, 100);
+	auto coin = std::uniform_int_distribution<int>(0, 1);
+	for (auto row = 0; row < side; row++) {
+		for (auto col = 0; col < side; col++) {
+			auto v = row * side + col;
+			if (col + 1 < side) {
+				map.AddUndirectedEdge(labels[v], labels[v + 1], weight(random));
+			}
+			if (row + 1 < side) {
+				map.AddUndirectedEdge(labels[v], labels[v + side], weight(random));
+			}
+			if (row + 1 < side && col + 1 < side && coin(random) == 1) {
+				map.AddUndirectedEdge(labels[v], labels[v + side + 1], weight(random));
+			}
+		}
+	}
+	map.Freeze();
+	return map;
+}
+
+template <typename Message>
+void Compare(const string& name, const int size, Message& message) {
+	BufferSocketHelper legacy, generated;
+	LegacyCodec::Encode(legacy, message);
+	GeneratedCodec::Encode(generated, message);
+	if (legacy.Bytes() != generated.Bytes()) {
+		throw EncodingMismatchException(name);
+	}
+
+	auto legacyEncode = MeasureEncode<LegacyCodec>(legacy, message);
+	auto generatedEncode = MeasureEncode<GeneratedCodec>(generated, message);
+	auto legacyDecode = MeasureDecode<LegacyCodec>(legacy, message);
+	auto generatedDecode = MeasureDecode<GeneratedCodec>(generated, message);
+
+	const int colWidth[] = { 18, 8, 10, 14, 14, 10, 14, 14, 10 };
+	cout << left << std::fixed << std::setprecision(1);
+	cout << setw(colWidth[0]) << name << setw(colWidth[1]) << size << setw(colWidth[2]) << generated.Bytes().size()
+		<< setw(colWidth[3]) << legacyEncode << setw(colWidth[4]) << generatedEncode << setw(colWidth[5]) << legacyEncode / generatedEncode
+		<< setw(colWidth[6]) << legacyDecode << setw(colWidth[7]) << generatedDecode << setw(colWidth[8]) << legacyDecode / generatedDecode << endl;
+}
+
+// encode/decode cost per message, field by field virtual calls against generated codecs (ns per message)
+void BenchmarkCodec() {
+	cout << "Fixed sections: ClientQuery " << (size_t)ClientQuery::FIXED_SIZE << " bytes, AllShortestPath " << (size_t)AllShortestPath::FIXED_SIZE
+		<< " bytes, AllDelay " << (size_t)AllDelay::FIXED_SIZE << " bytes, Response " << (size_t)Response::FIXED_SIZE << " bytes" << endl;
+	cout << "-------------------------------------------------------------------------------------------------------------" << endl;
+	cout << left << setw(18) << "Message" << setw(8) << "Size" << setw(10) << "Bytes" << setw(14) << "Enc legacy" << setw(14) << "Enc generated" << setw(10) << "Speedup"
+		<< setw(14) << "Dec legacy" << setw(14) << "Dec generated" << setw(10) << "Speedup" << endl;
+	cout << "-------------------------------------------------------------------------------------------------------------" << endl;
+	for (auto size : SIZES) {
+		Samples samples(size);
+		Compare("AllShortestPath", size, samples.path);
+		Compare("AllDelay", size, (AllDelay&)samples.delay);
+		Compare("Response", size, samples.response);
+	}
+	cout << "-------------------------------------------------------------------------------------------------------------" << endl;
+}
+
+// single source shortest path on a generated map, Dijkstra against delta-stepping with 1 to N threads (ms per query)
+void BenchmarkShortestPath(const Options& options) {
+	auto vertices = options.GetInt("vertices", DEFAULT_GENERATED_VERTICES);
+	auto degree = options.GetInt("degree", DEFAULT_GENERATED_DEGREE);
+	auto sources = options.GetInt("sources", DEFAULT_SOURCES);
+	auto start = NowMicroseconds();
+	auto map = GenerateMap(vertices, degree, 1);
+	cout << "Generated map of " << map.VertexCount() << " vertices and " << map.UndirectedEdgeCount() << " edges in " << (NowMicroseconds() - start) / 1000 << " ms, cores " << std::thread::hardware_concurrency() << endl;
+
+	std::mt19937 random(2);
+	vector<Node_t> sourceLabels;
+	for (auto i = 0; i < sources; i++) {
+		sourceLabels.push_back(Node_t(std::uniform_int_distribution<int>(0, vertices - 1)(random)) * 7 + 3);
+	}
+	auto run = [&](const EngineOptions& engine, vector<AllShortestPath>& results) {
+		auto start = NowMicroseconds();
+		for (const auto& source : sourceLabels) {
+			results.push_back(map.CalcShortestPath(source, engine));
+		}
+		return (NowMicroseconds() - start) / 1000.0 / sources;
+	};
+
+	vector<AllShortestPath> expected;
+	auto dijkstra = run(EngineOptions(), expected);
+	cout << "---------------------------------------------------------" << endl;
+	cout << left << setw(16) << "Engine" << setw(10) << "Threads" << setw(12) << "Delta" << setw(10) << "ms/query" << setw(10) << "Speedup" << endl;
+	cout << "---------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	cout << setw(16) << "Dijkstra" << setw(10) << 1 << setw(12) << "-" << setw(10) << dijkstra << setw(10) << 1.0 << endl;
+	for (const auto& threads : options.GetList("threads", "1,2,4,8")) {
+		ThreadPool pool(std::stoi(threads));
+		EngineOptions engine;
+		engine.pool = &pool;
+		engine.delta = options.GetInt("delta", 0);
+		engine.parallelThreshold = 0;
+		vector<AllShortestPath> results;
+		auto elapsed = run(engine, results);
+		for (size_t i = 0; i < results.size(); i++) {
+			if (results[i].distances != expected[i].distances) {
+				throw ResultMismatchException("delta-stepping");
+			}
+		}
+		cout << setw(16) << "Delta-stepping" << setw(10) << pool.Size() << setw(12) << (engine.delta > 0 ? engine.delta : map.DefaultDelta()) << setw(10) << elapsed << setw(10) << dijkstra / elapsed << endl;
+	}
+	cout << "---------------------------------------------------------" << endl;
+}
+
+// Dijkstra on a generated map renumbered by each vertex order (ms and cache misses per query)
+// --shape=grid is a road-like grid with shuffled labels, --shape=random the uniform random map of the sssp suite
+void BenchmarkReorder(const Options& options) {
+	auto vertices = options.GetInt("vertices", DEFAULT_GENERATED_VERTICES);
+	auto degree = options.GetInt("degree", DEFAULT_GENERATED_DEGREE);
+	auto sources = options.GetInt("sources", DEFAULT_SOURCES);
+	auto shape = options.Get("shape", "grid");
+	vector<Node_t> labels;
+	auto side = (int)std::sqrt((double)vertices);
+	auto original = shape == "grid" ? GenerateGridMap(side, 1, labels) : GenerateMap(vertices, degree, 1);
+	if (labels.empty()) {
+		for (auto i = 0; i < vertices; i++) {
+			labels.push_back(Node_t(i) * 7 + 3);
+		}
+	}
+	cout << "Generated " << shape << " map of " << original.VertexCount() << " vertices and " << original.UndirectedEdgeCount() << " edges" << endl;
+
+	std::mt19937 random(2);
+	vector<Node_t> sourceLabels;
+	for (auto i = 0; i < sources; i++) {
+		sourceLabels.push_back(labels[std::uniform_int_distribution<int>(0, labels.size() - 1)(random)]);
+	}
+	CacheMissCounter counter;
+	vector<AllShortestPath> expected;
+	double baseline = 0;
+	cout << "---------------------------------------------------------------------------" << endl;
+	cout << left << setw(10) << "Order" << setw(14) << "Reorder ms" << setw(12) << "Edge span" << setw(12) << "ms/query" << setw(10) << "Speedup" << setw(18) << "Misses/query" << endl;
+	cout << "---------------------------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	for (const auto& name : options.GetList("orders", "none,bfs,rcm,degree")) {
+		auto map = original;
+		auto start = NowMicroseconds();
+		map.Reorder(ParseVertexOrder(name));
+		auto reorder = (NowMicroseconds() - start) / 1000.0;
+		map.CalcShortestPath(sourceLabels[0]); // warm up scratch arrays
+		vector<AllShortestPath> results;
+		counter.Start();
+		start = NowMicroseconds();
+		for (const auto& source : sourceLabels) {
+			results.push_back(map.CalcShortestPath(source));
+		}
+		auto elapsed = (NowMicroseconds() - start) / 1000.0 / sources;
+		auto misses = counter.Stop();
+		if (expected.empty()) {
+			expected = results;
+			baseline = elapsed;
+		}
+		for (size_t i = 0; i < results.size(); i++) {
+			if (results[i].distances != expected[i].distances) {
+				throw ResultMismatchException(name + " order");
+			}
+		}
+		cout << setw(10) << name << setw(14) << reorder << setw(12) << map.MeanEdgeSpan() << setw(12) << elapsed << setw(10) << baseline / elapsed
+			<< setw(18) << (counter.Available() ? std::to_string(misses / sources) : string("n/a")) << endl;
+	}
+	cout << "---------------------------------------------------------------------------" << endl;
+}
+
+// Dijkstra on flat against compressed edges of a generated map renumbered by each vertex order (bytes per directed edge, ms per query)
+// gaps between neighbours shrink as neighbours get closer in vertex index, so the compressed size depends on the order
+void BenchmarkCompress(const Options& options) {
+	auto vertices = options.GetInt("vertices", DEFAULT_GENERATED_VERTICES);
+	auto degree = options.GetInt("degree", DEFAULT_GENERATED_DEGREE);
+	auto sources = options.GetInt("sources", DEFAULT_SOURCES);
+	auto shape = options.Get("shape", "grid");
+	vector<Node_t> labels;
+	auto side = (int)std::sqrt((double)vertices);
+	auto original = shape == "grid" ? GenerateGridMap(side, 1, labels) : GenerateMap(vertices, degree, 1);
+	if (labels.empty()) {
+		for (auto i = 0; i < vertices; i++) {
+			labels.push_back(Node_t(i) * 7 + 3);
+		}
+	}
+	cout << "Generated " << shape << " map of " << original.VertexCount() << " vertices and " << original.UndirectedEdgeCount() << " edges" << endl;
+
+	std::mt19937 random(2);
+	vector<Node_t> sourceLabels;
+	for (auto i = 0; i < sources; i++) {
+		sourceLabels.push_back(labels[std::uniform_int_distribution<int>(0, labels.size() - 1)(random)]);
+	}
+	auto measure = [&sourceLabels, sources](const Map& map, vector<AllShortestPath>& results) {
+		map.CalcShortestPath(sourceLabels[0]); // warm up scratch arrays
+		auto start = NowMicroseconds();
+		for (const auto& source : sourceLabels) {
+			results.push_back(map.CalcShortestPath(source));
+		}
+		return (NowMicroseconds() - start) / 1000.0 / sources;
+	};
+	cout << "---------------------------------------------------------------------------" << endl;
+	cout << left << setw(10) << "Order" << setw(14) << "Flat B/edge" << setw(16) << "Packed B/edge" << setw(12) << "Flat ms" << setw(12) << "Packed ms" << setw(10) << "Slowdown" << endl;
+	cout << "---------------------------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	for (const auto& name : options.GetList("orders", "none,rcm")) {
+		auto map = original;
+		map.Reorder(ParseVertexOrder(name));
+		vector<AllShortestPath> expected;
+		auto flat = measure(map, expected);
+		auto flatBytes = (double)map.EdgeBytes() / map.DirectedEdgeCount();
+		map.Compress();
+		vector<AllShortestPath> results;
+		auto packed = measure(map, results);
+		for (size_t i = 0; i < results.size(); i++) {
+			if (results[i].distances != expected[i].distances) {
+				throw ResultMismatchException(name + " compressed");
+			}
+		}
+		cout << setw(10) << name << setw(14) << flatBytes << setw(16) << (double)map.EdgeBytes() / map.DirectedEdgeCount() << setw(12) << flat << setw(12) << packed << setw(10) << packed / flat << endl;
+	}
+	cout << "---------------------------------------------------------------------------" << endl;
+}
+
+// point-to-point queries on a road-like grid map, Dijkstra stopping at the destination against contraction hierarchy
+void BenchmarkHierarchy(const Options& options) {
+	auto vertices = options.GetInt("vertices", DEFAULT_HIERARCHY_VERTICES);
+	auto pairs = options.GetInt("pairs", DEFAULT_PAIRS);
+	vector<Node_t> labels;
+	auto plain = GenerateGridMap((int)std::sqrt((double)vertices), 1, labels);
+	plain.Reorder(ParseVertexOrder(options.Get("reorder", "none")));
+	cout << "Generated grid map of " << plain.VertexCount() << " vertices and " << plain.UndirectedEdgeCount() << " edges" << endl;
+	auto indexed = plain;
+	auto start = NowMicroseconds();
+	indexed.BuildHierarchy();
+	const auto& hierarchy = *indexed.Hierarchy();
+	cout << "Built contraction hierarchy in " << (NowMicroseconds() - start) / 1000 << " ms: " << hierarchy.ShortcutCount() << " shortcuts, "
+		<< hierarchy.Bytes() / 1024 << " KB index, map adjacency " << (plain.UndirectedEdgeCount() * 2 * (sizeof(int) + sizeof(Distance_t)) + plain.VertexCount() * sizeof(int)) / 1024 << " KB" << endl;
+
+	std::mt19937 random(3);
+	auto vertex = std::uniform_int_distribution<int>(0, labels.size() - 1);
+	vector<std::pair<Node_t, Node_t>> queries;
+	for (auto i = 0; i < pairs; i++) {
+		queries.emplace_back(labels[vertex(random)], labels[vertex(random)]);
+	}
+	auto run = [&](const Map& map, vector<AllShortestPath>& results) {
+		auto start = NowMicroseconds();
+		for (const auto& query : queries) {
+			results.push_back(map.CalcShortestPathTo(query.first, query.second));
+		}
+		return (double)(NowMicroseconds() - start) / pairs;
+	};
+	auto sources = std::min(pairs, options.GetInt("sources", DEFAULT_SOURCES));
+	auto full = NowMicroseconds();
+	for (auto i = 0; i < sources; i++) {
+		plain.CalcShortestPath(queries[i].first);
+	}
+	auto fullElapsed = (double)(NowMicroseconds() - full) / sources;
+	vector<AllShortestPath> expected, results;
+	auto dijkstra = run(plain, expected);
+	auto contracted = run(indexed, results);
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].distances != expected[i].distances) {
+			throw ResultMismatchException("contraction hierarchy");
+		}
+	}
+	cout << "---------------------------------------------------------" << endl;
+	cout << left << setw(30) << "Engine" << setw(14) << "us/query" << setw(10) << "Speedup" << endl;
+	cout << "---------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	cout << setw(30) << "Dijkstra, all destinations" << setw(14) << fullElapsed << setw(10) << 1.0 << endl;
+	cout << setw(30) << "Dijkstra, stop at destination" << setw(14) << dijkstra << setw(10) << fullElapsed / dijkstra << endl;
+	cout << setw(30) << "Contraction hierarchy" << setw(14) << contracted << setw(10) << fullElapsed / contracted << endl;
+	cout << "---------------------------------------------------------" << endl;
+	cout << pairs << " pairs, all distances identical to Dijkstra" << endl;
+}
+
+// radius and k nearest queries on a road-like grid map against the full search, each checked against the full result filtered
+void BenchmarkBound(const Options& options) {
+	auto vertices = options.GetInt("vertices", DEFAULT_GENERATED_VERTICES);
+	auto sources = options.GetInt("sources", DEFAULT_SOURCES);
+	vector<Node_t> labels;
+	auto map = GenerateGridMap((int)std::sqrt((double)vertices), 1, labels);
+	cout << "Generated grid map of " << map.VertexCount() << " vertices and " << map.UndirectedEdgeCount() << " edges" << endl;
+	std::mt19937 random(4);
+	vector<Node_t> sourceLabels;
+	for (auto i = 0; i < sources; i++) {
+		sourceLabels.push_back(labels[std::uniform_int_distribution<int>(0, labels.size() - 1)(random)]);
+	}
+	vector<AllShortestPath> full;
+	auto start = NowMicroseconds();
+	for (const auto& source : sourceLabels) {
+		full.push_back(map.CalcShortestPath(source));
+	}
+	auto fullElapsed = (NowMicroseconds() - start) / 1000.0 / sources;
+
+	cout << "---------------------------------------------------------" << endl;
+	cout << left << setw(24) << "Bound" << setw(12) << "Rows" << setw(12) << "ms/query" << setw(10) << "Speedup" << endl;
+	cout << "---------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	cout << setw(24) << "none" << setw(12) << full[0].distances.size() << setw(12) << fullElapsed << setw(10) << 1.0 << endl;
+	auto run = [&](const string& name, const SearchBound& bound) {
+		vector<AllShortestPath> results;
+		auto start = NowMicroseconds();
+		for (const auto& source : sourceLabels) {
+			results.push_back(map.CalcShortestPathWithin(source, bound));
+		}
+		auto elapsed = (NowMicroseconds() - start) / 1000.0 / sources;
+		size_t rows = 0;
+		for (size_t i = 0; i < sourceLabels.size(); i++) {
+			const auto& result = results[i];
+			rows += result.distances.size();
+			// expected: filter the full result by distance, then keep the k nearest with ties by smaller label
+			vector<std::pair<Node_t, Distance_t>> expected;
+			for (const auto& row : full[i].distances) {
+				if (row.second <= bound.maxDistance) {
+					expected.push_back(row);
+				}
+			}
+			if (bound.k > 0 && expected.size() > (size_t)bound.k) {
+				std::sort(expected.begin(), expected.end(), [](const std::pair<Node_t, Distance_t>& a, const std::pair<Node_t, Distance_t>& b) {
+					return a.second != b.second ? a.second < b.second : a.first < b.first;
+				});
+				expected.resize(bound.k);
+				std::sort(expected.begin(), expected.end());
+			}
+			if (!std::equal(expected.begin(), expected.end(), result.distances.begin()) || expected.size() != result.distances.size()) {
+				throw ResultMismatchException(name + " bound");
+			}
+		}
+		cout << setw(24) << name << setw(12) << rows / sources << setw(12) << elapsed << setw(10) << fullElapsed / elapsed << endl;
+	};
+	for (auto k : { 10, 1000, 100000 }) {
+		SearchBound bound;
+		bound.k = k;
+		run("k " + std::to_string(k), bound);
+	}
+	for (auto radius : { 200, 2000, 20000 }) {
+		SearchBound bound;
+		bound.maxDistance = radius;
+		run("distance " + std::to_string(radius), bound);
+	}
+	cout << "---------------------------------------------------------" << endl;
+}
+
+// time to the first chunk of a stream against the whole stream and the full search, rows with their delays a chunk at a time as the AWS forwards them
+void BenchmarkStream(const Options& options) {
+	auto vertices = options.GetInt("vertices", DEFAULT_GENERATED_VERTICES);
+	auto sources = options.GetInt("sources", DEFAULT_SOURCES);
+	vector<Node_t> labels;
+	auto map = GenerateGridMap((int)std::sqrt((double)vertices), 1, labels);
+	cout << "Generated grid map of " << map.VertexCount() << " vertices and " << map.UndirectedEdgeCount() << " edges" << endl;
+	std::mt19937 random(5);
+	cout << "---------------------------------------------------------------------" << endl;
+	cout << left << setw(14) << "Chunk rows" << setw(14) << "Full ms" << setw(14) << "First ms" << setw(14) << "Stream ms" << setw(14) << "Max rows held" << endl;
+	cout << "---------------------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	for (auto chunkRows : { 16, DEFAULT_STREAM_CHUNK_ROWS, MAX_STREAM_CHUNK_ROWS }) {
+		double full = 0;
+		double first = 0;
+		double total = 0;
+		size_t held = 0;
+		for (auto i = 0; i < sources; i++) {
+			auto source = labels[std::uniform_int_distribution<int>(0, labels.size() - 1)(random)];
+			auto start = NowMicroseconds();
+			auto expected = map.CalcShortestPath(source);
+			auto expectedDelay = DefaultDelay(8000, expected);
+			full += (NowMicroseconds() - start) / 1000.0;
+
+			start = NowMicroseconds();
+			auto stream = ShortestPathStream(map, source, std::numeric_limits<Distance_t>::max());
+			vector<std::pair<Node_t, Distance_t>> streamed;
+			while (!stream.Done()) {
+				auto chunk = AllShortestPath(stream.Info(), source);
+				stream.Next(chunkRows, chunk.distances);
+				auto delay = DefaultDelay(8000, chunk);
+				if (streamed.empty()) {
+					first += (NowMicroseconds() - start) / 1000.0;
+				}
+				held = std::max(held, chunk.distances.size() + delay.delays.size());
+				streamed.insert(streamed.end(), chunk.distances.begin(), chunk.distances.end()); // for the check below
+			}
+			total += (NowMicroseconds() - start) / 1000.0;
+			std::sort(streamed.begin(), streamed.end());
+			if (streamed.size() != expected.distances.size() || !std::equal(streamed.begin(), streamed.end(), expected.distances.begin())) {
+				throw ResultMismatchException("stream");
+			}
+		}
+		cout << setw(14) << chunkRows << setw(14) << full / sources << setw(14) << first / sources << setw(14) << total / sources << setw(14) << held << endl;
+	}
+	cout << "---------------------------------------------------------------------" << endl;
+}
+
+// round trip latency and pipelined throughput of each transport between two threads, an echo thread sends every datagram back
+// a datagram is its payload size then the payload, size -1 stops the echo
+void BenchmarkTransport(const Options& options) {
+	auto trips = options.GetInt("trips", DEFAULT_ROUND_TRIPS);
+	auto open = [](const Transport transport, const char* port) {
+		if (transport == Transport::Shm) {
+			return std::unique_ptr<DatagramReceiveHelper>(new ShmReceiveSocketHelper(port));
+		}
+		return std::unique_ptr<DatagramReceiveHelper>(new UdpReceiveSocketHelper(port));
+	};
+	vector<char> payload(TRANSPORT_SIZES[sizeof(TRANSPORT_SIZES) / sizeof(int) - 1]);
+	auto send = [&payload](DatagramReceiveHelper& self, const char* port, const int size) {
+		auto sender = self.SendHelper(HOST, port);
+		sender->Write(size);
+		sender->WriteBlock(payload.data(), std::max(size, 0));
+		sender->Flush();
+	};
+	auto receive = [&payload](DatagramReceiveHelper& self) {
+		int size;
+		self.Read(size);
+		self.ReadBlock(payload.data(), size);
+		return size;
+	};
+
+	cout << "-------------------------------------------------------------------------" << endl;
+	cout << left << setw(12) << "Transport" << setw(10) << "Bytes" << setw(12) << "RTT us" << setw(12) << "p99 us" << setw(14) << "Datagrams/s" << setw(10) << "MB/s" << endl;
+	cout << "-------------------------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	for (auto transport : { Transport::Udp, Transport::Shm }) {
+		auto name = transport == Transport::Udp ? "udp" : "shm";
+		auto self = open(transport, BENCHMARK_PORTS[0]);
+		auto echo = open(transport, BENCHMARK_PORTS[1]);
+		vector<char> echoPayload(payload.size());
+		std::thread echoThread([&] {
+			while (true) {
+				int size;
+				echo->Read(size);
+				if (size < 0) {
+					return;
+				}
+				echo->ReadBlock(echoPayload.data(), size);
+				auto sender = echo->SendHelper(HOST, BENCHMARK_PORTS[0]);
+				sender->Write(size);
+				sender->WriteBlock(echoPayload.data(), size);
+				sender->Flush();
+			}
+		});
+		try {
+			for (auto size : TRANSPORT_SIZES) {
+				vector<Timestamp_t> latency;
+				latency.reserve(trips);
+				for (auto i = 0; i < trips; i++) {
+					auto start = NowMicroseconds();
+					send(*self, BENCHMARK_PORTS[1], size);
+					if (!self->Wait(1000)) {
+						throw DatagramLostException(name);
+					}
+					receive(*self);
+					latency.push_back(NowMicroseconds() - start);
+				}
+				auto mean = std::accumulate(latency.begin(), latency.end(), 0.0) / trips;
+				std::sort(latency.begin(), latency.end());
+
+				// pipelined, as many datagrams on the way as the in-flight bytes allow
+				auto window = std::min(TRANSPORT_INFLIGHT_DATAGRAMS, std::max(1, TRANSPORT_INFLIGHT_BYTES / size));
+				auto sent = 0;
+				auto received = 0;
+				auto start = NowMicroseconds();
+				while (received < trips) {
+					if (sent < trips && sent - received < window) {
+						send(*self, BENCHMARK_PORTS[1], size);
+						sent++;
+						continue;
+					}
+					if (!self->Wait(1000)) {
+						throw DatagramLostException(name);
+					}
+					receive(*self);
+					received++;
+				}
+				auto seconds = (NowMicroseconds() - start) / 1000000.0;
+				cout << setw(12) << name << setw(10) << size << setw(12) << mean << setw(12) << (double)latency[trips * 99 / 100] << setw(14) << trips / seconds << setw(10) << (double)trips * size / seconds / 1e6 << endl;
+			}
+		} catch (...) {
+			send(*echo, BENCHMARK_PORTS[1], -1); // echo reads its own port
+			echoThread.join();
+			throw;
+		}
+		send(*echo, BENCHMARK_PORTS[1], -1);
+		echoThread.join();
+	}
+	cout << "-------------------------------------------------------------------------" << endl;
+}
+
+// closed-loop throughput of main server with each count of reactors, started by the benchmark as ./aws --reactors=N
+// server A and server B must be running; every connection sends the query --map, --source again as soon as its reply arrives,
+// identical queries in flight share one request to server A, so main server and server B carry the load
+void BenchmarkReactor(const Options& options) {
+	auto seconds = options.GetDouble("seconds", DEFAULT_REACTOR_SECONDS);
+	auto connections = options.GetInt("connections", DEFAULT_REACTOR_CONNECTIONS);
+	auto query = ClientQuery(options.Get("map", "A")[0], options.GetInt("source", 0), 8000);
+	double baseline = 0;
+	cout << "---------------------------------------------------------------------------" << endl;
+	cout << left << setw(10) << "Reactors" << setw(14) << "Queries/s" << setw(10) << "Speedup" << setw(12) << "p50 ms" << setw(12) << "p99 ms" << setw(10) << "Failed" << endl;
+	cout << "---------------------------------------------------------------------------" << endl;
+	cout << std::fixed << std::setprecision(2);
+	for (const auto& reactors : options.GetList("reactors", "1,2,4,8")) {
+		auto argument = "--reactors=" + reactors;
+		char* argv[] = { (char*)"./aws", (char*)argument.c_str(), nullptr };
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+		pid_t pid;
+		auto spawned = posix_spawn(&pid, "./aws", &actions, nullptr, argv, environ);
+		posix_spawn_file_actions_destroy(&actions);
+		if (spawned != 0) {
+			throw ProcessStartException("./aws");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(REACTOR_START_MILLISECONDS));
+		if (waitpid(pid, nullptr, WNOHANG) != 0) {
+			throw ProcessStartException("./aws");
+		}
+
+		std::mutex mutex;
+		std::condition_variable finished;
+		vector<Timestamp_t> latencies;
+		size_t failed = 0;
+		auto inflight = 0;
+		Timestamp_t start, elapsed;
+		{
+			AwsClient client(HOST, SERVER_AWS_TCP_PORT, connections);
+			auto end = NowMicroseconds() + (Timestamp_t)(seconds * 1000000);
+			std::function<void()> send = [&] {
+				auto sent = NowMicroseconds();
+				client.Submit(query, [&, sent](std::future<Response> reply) {
+					auto ok = false;
+					try {
+						ok = reply.get().status == Status::Ok;
+					} catch (const std::exception&) {}
+					auto now = NowMicroseconds();
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						latencies.push_back(now - sent);
+						failed += !ok;
+						if (now >= end) {
+							inflight--;
+							finished.notify_all();
+							return;
+						}
+					}
+					send();
+				});
+			};
+			start = NowMicroseconds();
+			inflight = connections;
+			for (auto i = 0; i < connections; i++) {
+				send();
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [&inflight] { return inflight == 0; });
+			elapsed = NowMicroseconds() - start;
+		} // connections are closed by this end first, so that main server can bind its port again at once
+		kill(pid, SIGTERM);
+		waitpid(pid, nullptr, 0);
+
+		std::sort(latencies.begin(), latencies.end());
+		auto throughput = (latencies.size() - failed) / (elapsed / 1000000.0);
+		if (baseline == 0) {
+			baseline = throughput;
+		}
+		cout << setw(10) << reactors << setw(14) << throughput << setw(10) << throughput / baseline << setw(12) << latencies[latencies.size() / 2] / 1000.0
+			<< setw(12) << latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)] / 1000.0 << setw(10) << failed << endl;
+	}
+	cout << "---------------------------------------------------------------------------" << endl;
+}
+
+//===============================================//
+//                    Main                       //
+//===============================================//
+
+// ./benchmark [codec|sssp|reorder|compress|ch|bound|stream|transport|reactor] [--vertices=N] [--degree=N] [--sources=N] [--threads=1,2,4] [--delta=N] [--orders=none,bfs,rcm,degree] [--shape=grid|random] [--pairs=N] [--trips=N] [--reactors=1,2,4,8] [--seconds=5] [--connections=64] [--map=A] [--source=0]
+int main(int argc, char* argv[]) {
+	try {
+		auto options = Options(argc, argv);
+		auto suite = options.Positional().empty() ? string("all") : options.Positional()[0];
+		if (suite == "all" || suite == "codec") {
+			BenchmarkCodec();
+		}
+		if (suite == "all" || suite == "sssp") {
+			BenchmarkShortestPath(options);
+		}
+		if (suite == "all" || suite == "reorder") {
+			BenchmarkReorder(options);
+		}
+		if (suite == "all" || suite == "compress") {
+			BenchmarkCompress(options);
+		}
+		if (suite == "all" || suite == "ch") {
+			BenchmarkHierarchy(options);
+		}
+		if (suite == "all" || suite == "bound") {
+			BenchmarkBound(options);
+		}
+		if (suite == "all" || suite == "stream") {
+			BenchmarkStream(options);
+		}
+		if (suite == "all" || suite == "transport") {
+			BenchmarkTransport(options);
+		}
+		if (suite == "reactor") { // needs server A and server B running, not part of all
+			BenchmarkReactor(options);
+		}
+	} catch (const std::exception& ex) {
+		std::cerr << ex.what() << endl;
+	}
+	return 0;
+}
\ No newline at end of file
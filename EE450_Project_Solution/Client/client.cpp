@@ -5,6 +5,7 @@
 #include <netdb.h>
 
 #include "common.hpp"
+#include "awsClient.hpp"
 
 using std::cout;
 using std::left;
@@ -18,60 +19,220 @@ using std::endl;
 //===============================================//
 //                     Tool                      //
 //===============================================//
-// parse command line arugments
-ClientQuery Parse(int argc, char* argv[]) {
-	if (argc != 4) {
+// several source vertices separated by comma make a batch query
+bool IsBatch(const Options& options) {
+	const auto& argv = options.Positional();
+	return argv.size() > 1 && argv[1].find(',') != string::npos;
+}
+
+// parse map ID and file size, common to both kinds of query
+void ParseMapAndFileSize(const vector<string>& argv, char& nameId, FileSize_t& filesize) {
+	if (argv.size() != 3) {
 		throw ArgumentException("Wrong number of argument");
 	}
-	auto name = string(argv[1]);
+	auto name = argv[0];
 	if (!std::regex_match(name, std::regex("^[a-zA-z]$"))) {
 		throw ArgumentException("Map ID should be exactly 1 alphabet");
 	}
-	auto nameId = name[0];
+	nameId = name[0];
+	try {
+		filesize = std::stoll(argv[2]);
+	} catch (...) {
+		throw ArgumentException("Wrong file size");
+	}
+}
+
+template <typename Query>
+void ParseDeadline(const Options& options, Query& query) {
+	auto deadline = options.GetInt("deadline-ms", 0);
+	if (deadline > 0) {
+		query.deadline = WallClockMicroseconds() + deadline * 1000;
+	}
+}
+
+// destinations within a distance, an end-to-end delay in seconds, or the k nearest
+template <typename Query>
+void ParseBound(const Options& options, Query& query) {
+	query.maxDistance = options.GetInt("max-distance", -1);
+	query.maxDelay = options.GetDouble("max-delay", -1);
+	query.k = options.GetInt("k", 0);
+}
+
+// parse command line arugments
+ClientQuery Parse(const Options& options) {
+	const auto& argv = options.Positional();
+	char nameId;
+	FileSize_t filesize;
+	ParseMapAndFileSize(argv, nameId, filesize);
 	Node_t source;
 	try {
-		source = std::stoll(argv[2]);
+		source = std::stoll(argv[1]);
 	} catch (...) {
 		throw ArgumentException("Wrong source vertex id");
 	}
+	auto query = ClientQuery(nameId, source, filesize);
+	if (options.Has("destination")) {
+		try {
+			query.destination = std::stoll(options.Get("destination", ""));
+		} catch (...) {
+			throw ArgumentException("Wrong destination vertex id");
+		}
+	}
+	ParseDeadline(options, query);
+	ParseBound(options, query);
+	if (options.Has("stream")) {
+		query.kind = QueryKind::Stream;
+	}
+	return query;
+}
+
+// parse command line arugments of a batch query
+BatchQuery ParseBatch(const Options& options) {
+	const auto& argv = options.Positional();
+	char nameId;
 	FileSize_t filesize;
+	ParseMapAndFileSize(argv, nameId, filesize);
+	auto query = BatchQuery(nameId, filesize);
 	try {
-		filesize = std::stoll(argv[3]);
+		for (const auto& source : SplitList(argv[1], ',')) {
+			query.sources.push_back(std::stoll(source));
+		}
 	} catch (...) {
-		throw ArgumentException("Wrong file size");
+		throw ArgumentException("Wrong source vertex id");
 	}
-	return ClientQuery(nameId, source, filesize);
+	ParseDeadline(options, query);
+	ParseBound(options, query);
+	return query;
 }
 
 //===============================================//
 //                    Class                      //
 //===============================================//
 
+// the command line front of AwsClient
 class Connection {
 private:
-	TcpClientSocketHelper helper;
+	AwsClient client;
+
+	// wait for copies of the query sent over the pool, the first of them is printed
+	template <typename Reply>
+	Reply Collect(vector<std::future<Reply>>& replies, const Timestamp_t start) {
+		auto first = replies.front().get();
+		for (size_t i = 1; i < replies.size(); i++) {
+			replies[i].get();
+		}
+		if (replies.size() > 1) {
+			cout << "The client has received " << replies.size() << " responses over " << client.Connections() << " connections in " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+		}
+		return first;
+	}
+
+	template <typename Reply, typename Query>
+	vector<std::future<Reply>> Submit(const Query& query, const size_t repeat) {
+		vector<std::future<Reply>> replies;
+		for (size_t i = 0; i < repeat; i++) {
+			replies.push_back(client.Submit(query));
+		}
+		return replies;
+	}
 
 public:
-	Connection(): helper(TcpClientSocketHelper(HOST, SERVER_AWS_TCP_PORT)) {
+	explicit Connection(const size_t connections) : client(HOST, SERVER_AWS_TCP_PORT, connections) {
 		cout << "The client is up and running." << endl;
 	}
 
-	Response Process(const ClientQuery& query) {
-		query.Encode(helper);
-		cout << "The client has sent query to AWS using TCP: start vertex " << query.sourceNode << "; map " << query.mapName << "; file size " << query.fileSize << "." << endl;
+	// rows are printed as each chunk arrives
+	void ProcessStream(const ClientQuery& query) {
+		auto start = NowMicroseconds();
+		cout << "The client has sent a streaming query to AWS using TCP: start vertex " << query.sourceNode;
+		if (query.destination != ALL_DESTINATIONS) {
+			cout << "; destination " << query.destination;
+		}
+		cout << "; map " << query.mapName << "; file size " << query.fileSize << "." << endl;
 
-		auto response = Response(helper);
+		auto rows = size_t(0);
+		Timestamp_t firstRow = -1;
+		auto status = client.Stream(query, [&](const ResponseChunk& chunk) {
+			if (chunk.status != Status::Ok) {
+				return;
+			}
+			if (rows == 0 && (!chunk.values.empty() || chunk.last)) {
+				firstRow = NowMicroseconds() - start;
+				cout << "The client is receiving results from AWS:" << endl;
+				Response::PrintHeader();
+			}
+			Response::PrintRows(chunk.values.data(), chunk.values.data() + chunk.values.size());
+			rows += chunk.values.size();
+		}).get();
+		if (firstRow >= 0) {
+			Response::PrintFooter();
+		}
+		if (status != Status::Ok) {
+			cout << "The client has received failure from AWS: " << StatusText(status) << "." << endl;
+			return;
+		}
+		cout << "The client has received " << rows << " results from AWS, first after " << firstRow / 1000.0 << " ms, all after " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+	}
+
+	Response Process(const ClientQuery& query, const size_t repeat = 1) {
+		auto start = NowMicroseconds();
+		auto replies = Submit<Response>(query, repeat);
+		cout << "The client has sent query to AWS using TCP: start vertex " << query.sourceNode;
+		if (query.destination != ALL_DESTINATIONS) {
+			cout << "; destination " << query.destination;
+		}
+		cout << "; map " << query.mapName << "; file size " << query.fileSize << "." << endl;
+
+		auto response = Collect(replies, start);
+		if (response.status != Status::Ok) {
+			cout << "The client has received failure from AWS: " << StatusText(response.status) << "." << endl;
+			return response;
+		}
 		cout << "The client has received results from AWS:" << endl;
 		response.Print();
 		return response;
 	}
+
+	BatchResponse Process(const BatchQuery& query, const size_t repeat = 1) {
+		auto start = NowMicroseconds();
+		auto replies = Submit<BatchResponse>(query, repeat);
+		cout << "The client has sent query to AWS using TCP: " << query.sources.size() << " start vertices; map " << query.mapName << "; file size " << query.fileSize << "." << endl;
+
+		auto response = Collect(replies, start);
+		if (response.status != Status::Ok) {
+			cout << "The client has received failure from AWS: " << StatusText(response.status) << "." << endl;
+			return response;
+		}
+		cout << "The client has received results of " << response.sources.size() << " start vertices from AWS:" << endl;
+		response.Print();
+		return response;
+	}
 };
 
 int main(int argc, char* argv[]) {
 	try {
-		auto query = Parse(argc, argv);
-		auto conn = Connection();
-		auto response = conn.Process(query);
+		auto options = Options(argc, argv);
+		auto repeat = options.GetInt("repeat", 1);
+		if (repeat < 1) {
+			throw ArgumentException("Repeat should be at least 1");
+		}
+		auto connections = options.GetInt("connections", 1);
+		if (connections < 1) {
+			throw ArgumentException("Connections should be at least 1");
+		}
+		if (IsBatch(options)) {
+			auto query = ParseBatch(options);
+			Connection conn(connections);
+			conn.Process(query, repeat);
+			return 0;
+		}
+		auto query = Parse(options);
+		Connection conn(connections);
+		if (query.kind == QueryKind::Stream) {
+			conn.ProcessStream(query);
+			return 0;
+		}
+		auto response = conn.Process(query, repeat);
 	} catch (const std::exception & ex) {
 		std::cerr << ex.what() << endl;
 	}
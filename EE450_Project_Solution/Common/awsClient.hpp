@@ -0,0 +1,169 @@
+#pragma once
+
+#include <deque>
+#include <future>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const int DEFAULT_CLIENT_CONNECTIONS = 4;
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// queries to the main server from any thread, sent over a pool of connections each served by its own thread
+// a connection carries one query at a time, a query waits in queue until a connection is free; replies are decoded on the heap
+class AwsClient {
+private:
+	typedef std::function<void(std::unique_ptr<TcpClientSocketHelper>&)> Job; // sends a query on the connection and delivers the outcome
+
+	const char* host;
+	const char* port;
+	vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable queued;
+	std::deque<Job> jobs;
+	bool stopping = false;
+
+	void Work(std::unique_ptr<TcpClientSocketHelper> connection) {
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				queued.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty()) { // stopping, queries already submitted are finished first
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job(connection);
+		}
+	}
+
+	// run exchange on a free connection and hand done the future of its result; a connection that fails is reopened by its next query
+	template <typename Result, typename Exchange>
+	void Run(const Exchange& exchange, const std::function<void(std::future<Result>)>& done) {
+		auto job = [this, exchange, done](std::unique_ptr<TcpClientSocketHelper>& connection) {
+			ArenaBinding heap(nullptr); // reply outlives this job
+			std::promise<Result> promise;
+			try {
+				if (!connection) {
+					connection.reset(new TcpClientSocketHelper(host, port));
+				}
+				promise.set_value(exchange(*connection));
+			} catch (...) {
+				connection.reset(); // the rest of a reply may still be on the way
+				promise.set_exception(std::current_exception());
+			}
+			done(promise.get_future());
+		};
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		queued.notify_one();
+	}
+
+	template <typename Result, typename Exchange>
+	std::future<Result> Run(const Exchange& exchange) {
+		auto promise = std::make_shared<std::promise<Result>>();
+		Run<Result>(exchange, [promise](std::future<Result> result) {
+			try {
+				promise->set_value(result.get());
+			} catch (...) {
+				promise->set_exception(std::current_exception());
+			}
+		});
+		return promise->get_future();
+	}
+
+	template <typename Reply, typename Query>
+	static Reply Exchange(TcpClientSocketHelper& connection, const Query& query) {
+		query.Encode(connection);
+		return Reply(connection);
+	}
+
+	static std::function<Status(TcpClientSocketHelper&)> StreamExchange(const ClientQuery& query, const std::function<void(const ResponseChunk&)>& onChunk) {
+		auto request = query;
+		request.kind = QueryKind::Stream;
+		return [request, onChunk](TcpClientSocketHelper& connection) {
+			request.Encode(connection);
+			while (true) {
+				auto chunk = ResponseChunk(connection);
+				onChunk(chunk);
+				if (chunk.last || chunk.status != Status::Ok) {
+					return chunk.status;
+				}
+			}
+		};
+	}
+
+public:
+	// connections are opened here, one after another, so that a main server that is down fails the constructor
+	AwsClient(const char* _host = HOST, const char* _port = SERVER_AWS_TCP_PORT, const size_t connections = DEFAULT_CLIENT_CONNECTIONS) : host(_host), port(_port) {
+		if (connections == 0) {
+			throw ArgumentException("Client needs at least 1 connection");
+		}
+		vector<std::unique_ptr<TcpClientSocketHelper>> opened;
+		for (size_t i = 0; i < connections; i++) {
+			opened.emplace_back(new TcpClientSocketHelper(host, port));
+		}
+		for (auto& connection : opened) {
+			threads.emplace_back(&AwsClient::Work, this, std::move(connection));
+		}
+	}
+
+	AwsClient(const AwsClient&) = delete;
+	AwsClient& operator=(const AwsClient&) = delete;
+
+	~AwsClient() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		queued.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	size_t Connections() const {
+		return threads.size();
+	}
+
+	// returns at once; a failure of the query itself comes as the status of the response, a broken connection as the exception of the future
+	std::future<Response> Submit(const ClientQuery& query) {
+		return Run<Response>([query](TcpClientSocketHelper& connection) { return Exchange<Response>(connection, query); });
+	}
+
+	std::future<BatchResponse> Submit(const BatchQuery& query) {
+		return Run<BatchResponse>([query](TcpClientSocketHelper& connection) { return Exchange<BatchResponse>(connection, query); });
+	}
+
+	// done is called on a connection thread with the ready future, and must not throw
+	void Submit(const ClientQuery& query, const std::function<void(std::future<Response>)>& done) {
+		Run<Response>([query](TcpClientSocketHelper& connection) { return Exchange<Response>(connection, query); }, done);
+	}
+
+	void Submit(const BatchQuery& query, const std::function<void(std::future<BatchResponse>)>& done) {
+		Run<BatchResponse>([query](TcpClientSocketHelper& connection) { return Exchange<BatchResponse>(connection, query); }, done);
+	}
+
+	// results of query in chunks, each handed to onChunk on a connection thread as it arrives; the future gets the final status
+	std::future<Status> Stream(const ClientQuery& query, const std::function<void(const ResponseChunk&)>& onChunk) {
+		return Run<Status>(StreamExchange(query, onChunk));
+	}
+
+	void Stream(const ClientQuery& query, const std::function<void(const ResponseChunk&)>& onChunk, const std::function<void(std::future<Status>)>& done) {
+		Run<Status>(StreamExchange(query, onChunk), done);
+	}
+};
\ No newline at end of file
@@ -10,10 +10,22 @@
 #include <cassert>
 #include <memory>
 #include <tuple>
+#include <limits>
+#include <type_traits>
 #include <cfenv>
+#include <chrono>
+#include <stdexcept>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <csignal>
 
 #include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
+#include <pthread.h>
 
 using std::map;
 using std::string;
@@ -34,24 +46,79 @@ typedef double PropagationSpeed_t; // km/sec
 typedef double TransmissionSpeed_t; // byte/sec
 typedef long long FileSize_t; // bit
 typedef double Delay_t; // sec
+typedef unsigned long long RequestId_t;
+typedef long long Timestamp_t; // microsecond
 
 //===============================================//
 //                    Const                      //
 //===============================================//
 const int BYTE_SIZE = 8;
 const int FLOAT_PRECISION = 2;
-const int BUFFER_SIZE = 32768;
+const int BUFFER_SIZE = 32768; // largest datagram
+const size_t MAX_QUERY_SIZE = 1 << 20; // largest message a client sends to main server over TCP
+const size_t MAX_RESPONSE_SIZE = 1 << 30; // largest message main server sends to a client over TCP
+const int BUFFER_POOL_MIN_SIZE = 256; // smallest size class of BufferPool, power of 2
+const size_t BUFFER_POOL_KEEP = 64; // free buffers kept per size class, more are returned to the heap
+const size_t ARENA_BLOCK_SIZE = 65536;
 const int CONNECTION_LIMIT = 1;
 const char* HOST = "127.0.0.1";
 const char* SERVER_A_PORT = "21943";
 const char* SERVER_B_PORT = "22943";
 const char* SERVER_AWS_UDP_PORT = "23943";
 const char* SERVER_AWS_TCP_PORT = "24943";
+const int MAX_AWS_REACTORS = 64;
+const int REACTOR_REQUEST_SHIFT = 56; // request IDs of main server reactor r carry r in their top byte
+const Node_t ALL_DESTINATIONS = std::numeric_limits<Node_t>::min(); // destination of a query asking for every vertex
+const int STREAM_WINDOW_CHUNKS = 4; // chunks server A sends per request of a stream, the next request is sent when the first of them is forwarded
+const int DEFAULT_STREAM_CHUNK_ROWS = 256;
+const int MAX_STREAM_CHUNK_ROWS = 1024; // delays of a chunk fit in one datagram
 
 //===============================================//
 //                     Tool                      //
 //===============================================//
 
+// monotonic clock reading, used for latency measurement inside one process
+Timestamp_t NowMicroseconds() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// wall clock reading, used for deadlines shared between processes
+Timestamp_t WallClockMicroseconds() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// UDP port main server receives the reply to a request on, SERVER_AWS_UDP_PORT plus the reactor that sent it
+const char* AwsReplyPort(const RequestId_t& requestId) {
+	static const vector<string> ports = [] {
+		vector<string> result;
+		for (auto reactor = 0; reactor < MAX_AWS_REACTORS; reactor++) {
+			result.push_back(std::to_string(std::stoi(SERVER_AWS_UDP_PORT) + reactor));
+		}
+		return result;
+	}();
+	return ports[(requestId >> REACTOR_REQUEST_SHIFT) % MAX_AWS_REACTORS].c_str();
+}
+
+// split string by a single delimiter, empty tokens are dropped
+vector<string> SplitList(const string& str, const char delimiter) {
+	auto result = vector<string>();
+	string token;
+	for (const auto c : str) {
+		if (c == delimiter) {
+			if (!token.empty()) {
+				result.push_back(token);
+			}
+			token.clear();
+		} else {
+			token.push_back(c);
+		}
+	}
+	if (!token.empty()) {
+		result.push_back(token);
+	}
+	return result;
+}
+
 //===============================================//
 //                    Class                      //
 //===============================================//
@@ -98,6 +165,11 @@ public:
 	explicit ConnectException(const char* host, const char* port) : SocketException("Cannot connect to " + (host == nullptr ? string(HOST) : host) + ":" + port) {}
 };
 
+class ConnectionClosedException : public SocketException {
+public:
+	explicit ConnectionClosedException() : SocketException("Connection closed by peer") {}
+};
+
 class TooLargePayloadException : public EE450Exception {
 public:
 	explicit TooLargePayloadException() : EE450Exception("The size of payload is larger than the max supported size " + std::to_string(BUFFER_SIZE)) {}
@@ -118,6 +190,263 @@ public:
 	explicit ResultMappingError() : EE450Exception("Shortest path result and delay result mismatch") {}
 };
 
+//===================Option====================
+
+// command line options in "--name=value" or "--flag" form, other arguments are kept as positional arguments
+class Options {
+private:
+	map<string, string> values;
+	vector<string> positional;
+
+public:
+	Options() {}
+
+	Options(int argc, char* argv[]) {
+		for (auto i = 1; i < argc; i++) {
+			auto arg = string(argv[i]);
+			if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+				auto eq = arg.find('=');
+				if (eq == string::npos) {
+					values[arg.substr(2)] = "";
+				} else {
+					values[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+				}
+			} else {
+				positional.push_back(arg);
+			}
+		}
+	}
+
+	const vector<string>& Positional() const {
+		return positional;
+	}
+
+	bool Has(const string& name) const {
+		return values.find(name) != values.end();
+	}
+
+	string Get(const string& name, const string& defaultValue) const {
+		auto it = values.find(name);
+		return it == values.end() ? defaultValue : it->second;
+	}
+
+	long long GetInt(const string& name, const long long defaultValue) const {
+		auto it = values.find(name);
+		if (it == values.end()) {
+			return defaultValue;
+		}
+		try {
+			return std::stoll(it->second);
+		} catch (...) {
+			throw ArgumentException("Option --" + name + " should be an integer");
+		}
+	}
+
+	double GetDouble(const string& name, const double defaultValue) const {
+		auto it = values.find(name);
+		if (it == values.end()) {
+			return defaultValue;
+		}
+		try {
+			return std::stod(it->second);
+		} catch (...) {
+			throw ArgumentException("Option --" + name + " should be a number");
+		}
+	}
+
+	vector<string> GetList(const string& name, const string& defaultValue) const {
+		return SplitList(Get(name, defaultValue), ',');
+	}
+};
+
+// artificial reply delay of a backend replica, for measuring tail latency locally
+class DelayInjector {
+private:
+	int delayMilliseconds = 0;
+	double probability = 0;
+	std::mt19937 random;
+
+public:
+	DelayInjector(const Options& options) : delayMilliseconds(options.GetInt("delay-ms", 0)), probability(options.GetDouble("delay-probability", 1)), random(std::random_device()()) {}
+
+	void Inject() {
+		if (delayMilliseconds <= 0 || std::uniform_real_distribution<double>(0, 1)(random) >= probability) {
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(delayMilliseconds));
+	}
+};
+
+// work finished before the process stops on SIGINT or SIGTERM, such as writing out buffered records
+// the signals are left to one thread, which runs every hook; the first hook must be added before any other thread is started
+class StopHooks {
+private:
+	std::mutex mutex;
+	vector<std::function<void()>> hooks;
+
+	StopHooks() {}
+
+	void Run(sigset_t signals) {
+		auto signal = 0;
+		sigwait(&signals, &signal);
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto& hook : hooks) {
+			hook();
+		}
+		std::_Exit(128 + signal);
+	}
+
+public:
+	// never destroyed, the stopping thread may run while the process exits
+	static StopHooks& Instance() {
+		static auto instance = new StopHooks();
+		return *instance;
+	}
+
+	void Add(const std::function<void()>& hook) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (hooks.empty()) {
+			sigset_t signals;
+			sigemptyset(&signals);
+			sigaddset(&signals, SIGINT);
+			sigaddset(&signals, SIGTERM);
+			pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+			std::thread(&StopHooks::Run, this, signals).detach();
+		}
+		hooks.push_back(hook);
+	}
+};
+
+//===================Buffer Pool====================
+
+// recycled byte buffers in size classes of powers of 2 from BUFFER_POOL_MIN_SIZE to BUFFER_SIZE, shared by all threads
+class BufferPool {
+private:
+	static const int CLASSES = 16;
+
+	std::mutex mutex;
+	vector<char*> freeBuffers[CLASSES];
+
+	static int SizeClass(const int size) {
+		auto result = 0;
+		while ((BUFFER_POOL_MIN_SIZE << result) < size) {
+			result++;
+		}
+		return result;
+	}
+
+	BufferPool() {
+		static_assert((BUFFER_POOL_MIN_SIZE & (BUFFER_POOL_MIN_SIZE - 1)) == 0, "Size classes must be powers of 2");
+		static_assert(BUFFER_SIZE <= (BUFFER_POOL_MIN_SIZE << (CLASSES - 1)), "Largest datagram must fit the largest size class");
+	}
+
+public:
+	// never destroyed, so that buffers of objects destroyed at exit can still be released
+	static BufferPool& Instance() {
+		static auto pool = new BufferPool();
+		return *pool;
+	}
+
+	// buffer of at least size bytes, its whole size class is returned in capacity
+	char* Acquire(const int size, int& capacity) {
+		if (size > BUFFER_SIZE) {
+			throw TooLargePayloadException();
+		}
+		auto sizeClass = SizeClass(size);
+		capacity = BUFFER_POOL_MIN_SIZE << sizeClass;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto& buffers = freeBuffers[sizeClass];
+			if (!buffers.empty()) {
+				auto result = buffers.back();
+				buffers.pop_back();
+				return result;
+			}
+		}
+		return new char[capacity];
+	}
+
+	void Release(char* buffer, const int capacity) {
+		if (buffer == nullptr) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto& buffers = freeBuffers[SizeClass(capacity)];
+			if (buffers.size() < BUFFER_POOL_KEEP) {
+				buffers.push_back(buffer);
+				return;
+			}
+		}
+		delete[] buffer;
+	}
+};
+
+// bytes of one message in a buffer of BufferPool, moved to the next size class as they grow, returned to the pool when destroyed
+class PooledBuffer {
+private:
+	char* data = nullptr;
+	int capacity = 0;
+	int length = 0;
+
+public:
+	PooledBuffer() {}
+
+	explicit PooledBuffer(const int size) {
+		Reserve(size);
+	}
+
+	PooledBuffer(const PooledBuffer&) = delete;
+	PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+	~PooledBuffer() {
+		BufferPool::Instance().Release(data, capacity);
+	}
+
+	char* Data() const {
+		return data;
+	}
+
+	int Length() const {
+		return length;
+	}
+
+	int Capacity() const {
+		return capacity;
+	}
+
+	// room for at least size bytes, the bytes already in are kept
+	void Reserve(const int size) {
+		if (size <= capacity) {
+			return;
+		}
+		int grownCapacity;
+		auto grown = BufferPool::Instance().Acquire(size, grownCapacity);
+		if (length > 0) {
+			memcpy(grown, data, length);
+		}
+		BufferPool::Instance().Release(data, capacity);
+		data = grown;
+		capacity = grownCapacity;
+	}
+
+	void Append(const char* bytes, const int size) {
+		Reserve(length + size);
+		memcpy(data + length, bytes, size);
+		length += size;
+	}
+
+	// bytes written into Data() directly
+	void Resize(const int size) {
+		Reserve(size);
+		length = size;
+	}
+
+	void Clear() {
+		length = 0;
+	}
+};
+
 //===================Socket Wrapper====================
 
 // encoder/decoder abstraction
@@ -125,6 +454,9 @@ class SocketHelper {
 protected:
 	virtual void Read(char* buffer, const int size) = 0;
 	virtual void Write(const char* buffer, const int size) = 0;
+	virtual void Peek(char* buffer, const int size) {
+		throw UnsupportedOperationException();
+	}
 public:
 	
 	template <typename T>
@@ -132,37 +464,63 @@ public:
 		Read((char*)&buffer, sizeof(buffer));
 	}
 
+	// read without consuming
+	template <typename T>
+	T Peek() {
+		T result;
+		Peek((char*)&result, sizeof(result));
+		return result;
+	}
+
 	template <typename T>
 	void Write(const T& buffer) {
 		Write((char*)&buffer, sizeof(buffer));
 	}
 
+	// raw bytes, used by generated message codecs to move a whole section with one call
+	void ReadBlock(char* buffer, const int size) {
+		Read(buffer, size);
+	}
+
+	void WriteBlock(const char* buffer, const int size) {
+		Write(buffer, size);
+	}
+
+	// at most this many bytes of the message being read are left, a vector field claiming more is rejected before it is allocated
+	virtual size_t Remaining() const {
+		return std::numeric_limits<int>::max();
+	}
+
 	virtual void Flush() = 0;
 };
 
 class TcpSocketHelper : public SocketHelper {
-private:
-	char* receiveBuffer[BUFFER_SIZE];
-	int receiveBufferLen = 0;
-	int receiveBufferIndex = 0;
-	
 protected:
 	int tcpSocket = -1;
+	size_t messageLimit; // a stream does not tell how much of a message is left, the largest message the peer may send bounds it
+
+	explicit TcpSocketHelper(const size_t _messageLimit) : messageLimit(_messageLimit) {}
 
 	static void ReadStream(const int tcpSocket, char* buffer, const int size) {
 		auto total = 0;
 		while (total < size) {
 			auto receivedLen = recv(tcpSocket, buffer + total, size - total, 0);
-			assert(receivedLen >= 0);
+			if (receivedLen <= 0) {
+				throw ConnectionClosedException();
+			}
 			total += receivedLen;
 		}
 		assert(total == size);
 	}
 
+	// a closed peer fails the write instead of raising SIGPIPE
 	static void WriteStream(const int tcpSocket, const char* buffer, const int size) {
 		auto total = 0;
 		while (total != size) {
-			auto sendLen = send(tcpSocket, buffer + total, size - total, 0);
+			auto sendLen = send(tcpSocket, buffer + total, size - total, MSG_NOSIGNAL);
+			if (sendLen < 0) {
+				throw ConnectionClosedException();
+			}
 			total += sendLen;
 		}
 	}
@@ -181,6 +539,23 @@ public:
 		WriteStream(tcpSocket, buffer, size);
 	}
 
+	virtual void Peek(char* buffer, const int size) {
+		if (recv(tcpSocket, buffer, size, MSG_PEEK | MSG_WAITALL) != size) {
+			throw PayloadSizeMismatchException();
+		}
+	}
+	using SocketHelper::Peek;
+
+	virtual size_t Remaining() const {
+		return messageLimit;
+	}
+
+	// wait for the next message of a connection carrying several, false once the peer has closed it
+	bool WaitMessage() {
+		char next;
+		return recv(tcpSocket, &next, 1, MSG_PEEK) == 1;
+	}
+
 	virtual void Flush() { }
 };
 
@@ -188,7 +563,7 @@ class TcpClientSocketHelper : public TcpSocketHelper {
 private:
 	
 public:
-	TcpClientSocketHelper(const char* _remoteHost, const char* _remotePort) {
+	TcpClientSocketHelper(const char* _remoteHost, const char* _remotePort) : TcpSocketHelper(MAX_RESPONSE_SIZE) {
 		assert(_remoteHost != nullptr && _remotePort != nullptr);
 		addrinfo hints = {};
 		addrinfo* serverInfo;
@@ -224,7 +599,7 @@ private:
 	socklen_t addr_size = sizeof(their_addr);
 	friend class TcpServerSocketBuilder;
 protected:
-	TcpServerSocketHelper() {};
+	TcpServerSocketHelper() : TcpSocketHelper(MAX_QUERY_SIZE) {};
 
 public:
 
@@ -236,7 +611,8 @@ private:
 	int tcpSocket = -1;
 
 public:
-	TcpServerSocketBuilder(const char* _selfPort) {
+	// with reusePort, several listeners of one process or more share the port and the kernel spreads connections among them
+	TcpServerSocketBuilder(const char* _selfPort, const bool reusePort = false) {
 		if (_selfPort == nullptr) {
 			throw ArgumentException("Self port number is null");
 		}
@@ -253,6 +629,12 @@ public:
 			if ((tcpSocket = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
 				continue;
 			}
+			auto yes = 1;
+			if (reusePort && setsockopt(tcpSocket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) != 0) {
+				close(tcpSocket);
+				tcpSocket = -1;
+				continue;
+			}
 			if (bind(tcpSocket, p->ai_addr, p->ai_addrlen) != 0) {
 				close(tcpSocket);
 				tcpSocket = -1;
@@ -284,10 +666,23 @@ public:
 	}
 };
 
+// receiving end of datagrams from processes on this host, which also creates the senders replying from the same end
+class DatagramReceiveHelper : public SocketHelper {
+public:
+	virtual ~DatagramReceiveHelper() {}
+
+	virtual std::unique_ptr<SocketHelper> SendHelper(const char* _remoteHost, const char* _remotePort) = 0;
+
+	// wait until a datagram is readable, negative timeout waits forever
+	virtual bool Wait(const int timeoutMilliseconds) = 0;
+
+	// drop the rest of current datagram, e.g. a late reply nobody waits for
+	virtual void Discard() = 0;
+};
+
 class UdpSocketHelper : public SocketHelper {
 protected:
-	char buffer[BUFFER_SIZE];
-	int bufferLength = 0;
+	PooledBuffer buffer; // grows with the message
 	int udpSocket = -1;
 };
 
@@ -303,11 +698,10 @@ private:
 
 	// write local buffer
 	void WriteDatagram(const char* buffer, const int size) {
-		if (bufferLength + size > BUFFER_SIZE) {
+		if (this->buffer.Length() + size > BUFFER_SIZE) {
 			throw TooLargePayloadException();
 		}
-		memcpy(this->buffer + bufferLength, buffer, size);
-		bufferLength += size;
+		this->buffer.Append(buffer, size);
 	}
 
 	// private constructor, can only called by UdpReceiveSocketHelper
@@ -342,39 +736,48 @@ public:
 		if (serverInfo->ai_next != nullptr) {
 			throw MultipleRemoteHostException(remoteHost, remotePort);
 		}
-		auto sendLen = sendto(udpSocket, buffer, bufferLength, 0, serverInfo->ai_addr, serverInfo->ai_addrlen);
-		if (sendLen != bufferLength) {
+		auto sendLen = sendto(udpSocket, buffer.Data(), buffer.Length(), 0, serverInfo->ai_addr, serverInfo->ai_addrlen);
+		if (sendLen != buffer.Length()) {
 			throw SendLengthMismatchException();
 		}
 		freeaddrinfo(serverInfo);
 
-		bufferLength = 0;
+		buffer.Clear();
 	}
 };
 
 // wrapper of binded UDP receiver
-class UdpReceiveSocketHelper : public UdpSocketHelper {
+class UdpReceiveSocketHelper : public DatagramReceiveHelper {
 private:
+	PooledBuffer buffer; // the largest size, length of a datagram is unknown until it is received
 	int readIndex = 0;
+	int udpSocket = -1;
 
 	addrinfo* serverInfo = nullptr;
 	addrinfo* p;
 
-	void ReadDatagram(const int udpSocket, char* buffer, const int size) {
-		assert(readIndex <= bufferLength);
-		if (readIndex == bufferLength) { // buffered data run out, receive new data
-			bufferLength = recvfrom(udpSocket, this->buffer, BUFFER_SIZE, 0, p->ai_addr, &p->ai_addrlen);
+	void ReceiveDatagram(const int udpSocket) {
+		assert(readIndex <= buffer.Length());
+		if (readIndex == buffer.Length()) { // buffered data run out, receive new data
+			buffer.Resize(recvfrom(udpSocket, buffer.Data(), buffer.Capacity(), 0, p->ai_addr, &p->ai_addrlen));
 			readIndex = 0;
 		}
-		// consume buffered data
-		if (readIndex + size > bufferLength) {
+	}
+
+	void ReadDatagram(const int udpSocket, char* buffer, const int size) {
+		PeekDatagram(udpSocket, buffer, size);
+		readIndex += size;
+	}
+
+	void PeekDatagram(const int udpSocket, char* buffer, const int size) {
+		ReceiveDatagram(udpSocket);
+		if (readIndex + size > this->buffer.Length()) {
 			throw PayloadSizeMismatchException();
 		}
-		memcpy(buffer, this->buffer + readIndex, size);
-		readIndex += size;
+		memcpy(buffer, this->buffer.Data() + readIndex, size);
 	}
 public:
-	UdpReceiveSocketHelper(const char* _selfPort) {
+	UdpReceiveSocketHelper(const char* _selfPort) : buffer(BUFFER_SIZE) {
 		if (_selfPort == nullptr) {
 			throw ArgumentException("Self port number is null");
 		}
@@ -405,14 +808,38 @@ public:
 	}
 
 	// create a send helper using the same socket
-	std::unique_ptr<UdpSendSocketHelper> SendHelper(const char* _remoteHost, const char* _remotePort) {
-		return std::unique_ptr<UdpSendSocketHelper>(new UdpSendSocketHelper(udpSocket, _remoteHost, _remotePort));
+	virtual std::unique_ptr<SocketHelper> SendHelper(const char* _remoteHost, const char* _remotePort) {
+		return std::unique_ptr<SocketHelper>(new UdpSendSocketHelper(udpSocket, _remoteHost, _remotePort));
+	}
+
+	virtual bool Wait(const int timeoutMilliseconds) {
+		if (readIndex < buffer.Length()) {
+			return true;
+		}
+		pollfd fd = {};
+		fd.fd = udpSocket;
+		fd.events = POLLIN;
+		return poll(&fd, 1, timeoutMilliseconds) > 0;
+	}
+
+	virtual void Discard() {
+		readIndex = buffer.Length();
 	}
 
 	virtual void Read(char* buffer, const int size) {
 		ReadDatagram(udpSocket, buffer, size);
 	}
 
+	// a message is one datagram
+	virtual size_t Remaining() const {
+		return buffer.Length() - readIndex;
+	}
+
+	virtual void Peek(char* buffer, const int size) {
+		PeekDatagram(udpSocket, buffer, size);
+	}
+	using SocketHelper::Peek;
+
 	virtual void Write(const char* buffer, const int size) {
 		throw UnsupportedOperationException();
 	}
@@ -422,10 +849,372 @@ public:
 	}
 };
 
+//===================Memory====================
+
+// bump allocator for objects living within one request, memory is reused after Reset instead of being freed
+class MonotonicArena {
+private:
+	struct Block {
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	vector<Block> blocks;
+	size_t current = 0; // block being used
+	size_t used = 0; // bytes used in current block
+
+public:
+	MonotonicArena() {}
+	MonotonicArena(const MonotonicArena&) = delete;
+	MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+	void* Allocate(const size_t size, const size_t alignment) {
+		while (true) {
+			if (current < blocks.size()) {
+				auto base = (size_t)blocks[current].data.get();
+				auto offset = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+				if (offset + size <= blocks[current].size) {
+					used = offset + size;
+					return blocks[current].data.get() + offset;
+				}
+				if (current + 1 < blocks.size()) { // move on to a block kept from earlier requests
+					current++;
+					used = 0;
+					continue;
+				}
+			}
+			auto blockSize = std::max(std::max(ARENA_BLOCK_SIZE, size + alignment), blocks.empty() ? 0 : blocks.back().size * 2);
+			blocks.push_back(Block{ std::unique_ptr<char[]>(new char[blockSize]), blockSize });
+			current = blocks.size() - 1;
+			used = 0;
+		}
+	}
+
+	// release everything allocated, blocks are kept for next request
+	void Reset() {
+		current = 0;
+		used = 0;
+	}
+
+	size_t Capacity() const {
+		auto result = size_t(0);
+		for (const auto& block : blocks) {
+			result += block.size;
+		}
+		return result;
+	}
+};
+
+// arena used by allocators created in this thread, null means global heap
+MonotonicArena*& CurrentArena() {
+	static thread_local MonotonicArena* arena = nullptr;
+	return arena;
+}
+
+// make allocations of this thread go to the given arena (or global heap if null) within the scope
+class ArenaBinding {
+private:
+	MonotonicArena* previous;
+
+public:
+	explicit ArenaBinding(MonotonicArena* arena) : previous(CurrentArena()) {
+		CurrentArena() = arena;
+	}
+
+	ArenaBinding(const ArenaBinding&) = delete;
+	ArenaBinding& operator=(const ArenaBinding&) = delete;
+
+	~ArenaBinding() {
+		CurrentArena() = previous;
+	}
+};
+
+// scope of one request, messages created within it are allocated from the arena of this thread, which is reset at exit
+class RequestArenaScope {
+private:
+	static MonotonicArena& ThreadArena() {
+		static thread_local MonotonicArena arena;
+		return arena;
+	}
+
+	ArenaBinding binding;
+
+public:
+	RequestArenaScope() : binding(&ThreadArena()) {}
+
+	~RequestArenaScope() {
+		ThreadArena().Reset();
+	}
+};
+
+// allocator of the arena current at construction, copies of containers go to the arena current at copying
+template <typename T>
+struct ArenaAllocator {
+	typedef T value_type;
+
+	MonotonicArena* arena;
+
+	ArenaAllocator() : arena(CurrentArena()) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(const size_t n) {
+		if (arena == nullptr) {
+			return (T*)::operator new(n * sizeof(T));
+		}
+		return (T*)arena->Allocate(n * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T* p, const size_t n) {
+		if (arena == nullptr) {
+			::operator delete(p);
+		}
+	}
+
+	ArenaAllocator select_on_container_copy_construction() const {
+		return ArenaAllocator();
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+	return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+	return a.arena != b.arena;
+}
+
+// contiguous container in arena, used for message fields kept sorted by key
+template <typename T>
+using FlatVector = std::vector<T, ArenaAllocator<T>>;
+
+//===================Codec====================
+
+// types encoded as raw bytes, std::pair and std::tuple are not trivially copyable but their bytes can still be copied
+template <typename T>
+struct IsBitwise : std::integral_constant<bool, std::is_trivially_copyable<T>::value> {};
+
+template <typename A, typename B>
+struct IsBitwise<std::pair<A, B>> : std::integral_constant<bool, IsBitwise<A>::value && IsBitwise<B>::value> {};
+
+template <>
+struct IsBitwise<std::tuple<>> : std::true_type {};
+
+template <typename Head, typename... Tail>
+struct IsBitwise<std::tuple<Head, Tail...>> : std::integral_constant<bool, IsBitwise<Head>::value && IsBitwise<std::tuple<Tail...>>::value> {};
+
+// encoding of one message field: a fixed size field is copied as is, a vector is its element count followed by its elements
+template <typename T>
+struct FieldCodec {
+	static_assert(IsBitwise<T>::value, "Message field should be copyable as bytes");
+	static const bool variable = false;
+	static const size_t fixedSize = sizeof(T);
+
+	static void EncodeFixed(char*& out, const T& field) {
+		memcpy(out, &field, sizeof(T));
+		out += sizeof(T);
+	}
+
+	static void DecodeFixed(SocketHelper& socket, const char*& in, T& field) {
+		memcpy(&field, in, sizeof(T));
+		in += sizeof(T);
+	}
+
+	static size_t VariableSize(const T& field) {
+		return 0;
+	}
+};
+
+template <typename T>
+struct FieldCodec<FlatVector<T>> {
+	static_assert(IsBitwise<T>::value, "Message field element should be copyable as bytes");
+	static const bool variable = true;
+	static const size_t fixedSize = sizeof(int); // element count
+
+	static void EncodeFixed(char*& out, const FlatVector<T>& field) {
+		int size = field.size();
+		memcpy(out, &size, sizeof(size));
+		out += sizeof(size);
+	}
+
+	static void EncodeVariable(SocketHelper& socket, const FlatVector<T>& field) {
+		if (!field.empty()) {
+			socket.WriteBlock((const char*)field.data(), field.size() * sizeof(T));
+		}
+	}
+
+	// the element count comes from the peer, it must fit the bytes the message still has before anything is allocated for it
+	static void DecodeFixed(SocketHelper& socket, const char*& in, FlatVector<T>& field) {
+		int size;
+		memcpy(&size, in, sizeof(size));
+		in += sizeof(size);
+		if (size < 0 || (size_t)size * sizeof(T) > socket.Remaining()) {
+			throw PayloadSizeMismatchException();
+		}
+		field.resize(size);
+	}
+
+	static void DecodeVariable(SocketHelper& socket, FlatVector<T>& field) {
+		if (!field.empty()) {
+			socket.ReadBlock((char*)field.data(), field.size() * sizeof(T));
+		}
+	}
+
+	static size_t VariableSize(const FlatVector<T>& field) {
+		return field.size() * sizeof(T);
+	}
+};
+
+// bytes of fields [I, N) which are read or written together, a section ends after the element count of a vector
+template <typename Tuple, size_t I, size_t N = std::tuple_size<Tuple>::value>
+struct SectionSize {
+	typedef FieldCodec<typename std::decay<typename std::tuple_element<I, Tuple>::type>::type> Codec;
+	static const size_t value = Codec::fixedSize + (Codec::variable ? 0 : SectionSize<Tuple, I + 1, N>::value);
+};
+
+template <typename Tuple, size_t N>
+struct SectionSize<Tuple, N, N> {
+	static const size_t value = 0;
+};
+
+// bytes of all fixed size parts of a message
+template <typename Tuple, size_t I = 0, size_t N = std::tuple_size<Tuple>::value>
+struct FixedSize {
+	static const size_t value = FieldCodec<typename std::decay<typename std::tuple_element<I, Tuple>::type>::type>::fixedSize + FixedSize<Tuple, I + 1, N>::value;
+};
+
+template <typename Tuple, size_t N>
+struct FixedSize<Tuple, N, N> {
+	static const size_t value = 0;
+};
+
+// bytes of all variable size parts of a message
+template <typename Tuple, size_t I = 0, size_t N = std::tuple_size<Tuple>::value>
+struct VariableSize {
+	static size_t Of(const Tuple& fields) {
+		return FieldCodec<typename std::decay<typename std::tuple_element<I, Tuple>::type>::type>::VariableSize(std::get<I>(fields)) + VariableSize<Tuple, I + 1, N>::Of(fields);
+	}
+};
+
+template <typename Tuple, size_t N>
+struct VariableSize<Tuple, N, N> {
+	static size_t Of(const Tuple&) {
+		return 0;
+	}
+};
+
+// codec generated from the field list of a message, fixed size parts are gathered into one buffer and written with one call
+template <typename Tuple, size_t I = 0, size_t N = std::tuple_size<Tuple>::value>
+struct MessageCodec {
+	typedef FieldCodec<typename std::decay<typename std::tuple_element<I, Tuple>::type>::type> Codec;
+
+	static void Encode(SocketHelper& socket, const Tuple& fields, char* section, char* out) {
+		Codec::EncodeFixed(out, std::get<I>(fields));
+		if (Codec::variable) {
+			socket.WriteBlock(section, out - section);
+			EncodeVariable(socket, std::get<I>(fields), std::integral_constant<bool, Codec::variable>());
+			out = section;
+		}
+		MessageCodec<Tuple, I + 1, N>::Encode(socket, fields, section, out);
+	}
+
+	static void Decode(SocketHelper& socket, const Tuple& fields, char* section, const char* in, const bool sectionStart) {
+		if (sectionStart) {
+			socket.ReadBlock(section, SectionSize<Tuple, I>::value);
+			in = section;
+		}
+		Codec::DecodeFixed(socket, in, std::get<I>(fields));
+		if (Codec::variable) {
+			DecodeVariable(socket, std::get<I>(fields), std::integral_constant<bool, Codec::variable>());
+		}
+		MessageCodec<Tuple, I + 1, N>::Decode(socket, fields, section, in, Codec::variable);
+	}
+
+private:
+	template <typename Field>
+	static void EncodeVariable(SocketHelper& socket, const Field& field, std::true_type) {
+		Codec::EncodeVariable(socket, field);
+	}
+
+	template <typename Field>
+	static void EncodeVariable(SocketHelper&, const Field&, std::false_type) {}
+
+	template <typename Field>
+	static void DecodeVariable(SocketHelper& socket, Field& field, std::true_type) {
+		Codec::DecodeVariable(socket, field);
+	}
+
+	template <typename Field>
+	static void DecodeVariable(SocketHelper&, Field&, std::false_type) {}
+};
+
+template <typename Tuple, size_t N>
+struct MessageCodec<Tuple, N, N> {
+	static void Encode(SocketHelper& socket, const Tuple&, char* section, char* out) {
+		if (out != section) {
+			socket.WriteBlock(section, out - section);
+		}
+	}
+
+	static void Decode(SocketHelper&, const Tuple&, char*, const char*, const bool) {}
+};
+
+template <typename Tuple>
+void EncodeFields(SocketHelper& socket, const Tuple& fields) {
+	char section[FixedSize<Tuple>::value];
+	MessageCodec<Tuple>::Encode(socket, fields, section, section);
+}
+
+template <typename Tuple>
+void DecodeFields(SocketHelper& socket, const Tuple& fields) {
+	char section[FixedSize<Tuple>::value];
+	MessageCodec<Tuple>::Decode(socket, fields, section, section, true);
+}
+
+// declare fields of a message once, in encoding order
+#define MESSAGE_FIELDS(...) \
+	auto Fields() -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); } \
+	auto Fields() const -> decltype(std::tie(__VA_ARGS__)) { return std::tie(__VA_ARGS__); } \
+	static const size_t FIXED_SIZE = FixedSize<decltype(std::tie(__VA_ARGS__))>::value; \
+	size_t EncodedSize() const { return FIXED_SIZE + VariableSize<decltype(std::tie(__VA_ARGS__))>::Of(Fields()); }
+
 //===================Container====================
 
+// outcome of a request, rejected requests carry no result
+enum class Status : char {
+	Ok,
+	DeadlineExceeded,
+	Overloaded,
+	Unavailable, // a server the request depends on did not answer
+	NotFound, // the map or the source vertex of the query does not exist
+	TooLarge, // the result does not fit in one datagram
+};
+
+string StatusText(const Status status) {
+	switch (status) {
+	case Status::Ok:
+		return "ok";
+	case Status::DeadlineExceeded:
+		return "deadline exceeded";
+	case Status::Overloaded:
+		return "overloaded";
+	case Status::Unavailable:
+		return "unavailable";
+	case Status::NotFound:
+		return "not found";
+	case Status::TooLarge:
+		return "too large";
+	}
+	return "unknown";
+}
+
 class Serializable {
 public:
+	virtual ~Serializable() {}
+
 	virtual void Encode(SocketHelper& socket) const = 0;
 
 };
@@ -435,47 +1224,39 @@ struct MapInfo {
 	PropagationSpeed_t propagationSpeed;
 	TransmissionSpeed_t transmissionSpeed;
 
-	MapInfo() {}
+	MapInfo() : name(0), propagationSpeed(0), transmissionSpeed(0) {}
 	MapInfo(const char _name, const PropagationSpeed_t& _propagationSpeed, const TransmissionSpeed_t& _transmissionSpeed) : name(_name), propagationSpeed(_propagationSpeed), transmissionSpeed(_transmissionSpeed) {}
 };
 
 // Response struct for server A response to main server and further be forward to server B
 struct AllShortestPath : public Serializable {
+	RequestId_t requestId = 0; // copied from the query, so that late replies can be told apart
+	Status status = Status::Ok;
 	MapInfo mapInfo;
 	Node_t sourceNode; // this field is unnecessary, but I want to keep it.
 
-	map<Node_t, Distance_t> distances;
+	FlatVector<std::pair<Node_t, Distance_t>> distances; // ascending by destination
 
 	AllShortestPath(const MapInfo& _mapInfo, const Node_t& _sourceNode) : mapInfo(_mapInfo), sourceNode(_sourceNode) {}
 
+	// rejection without result
+	AllShortestPath(const RequestId_t& _requestId, const Status _status) : requestId(_requestId), status(_status), sourceNode(0) {}
+
+	MESSAGE_FIELDS(requestId, status, mapInfo, sourceNode, distances)
+
 	AllShortestPath(SocketHelper& socket) {
-		socket.Read(mapInfo);
-		socket.Read(sourceNode);
-		int size;
-		socket.Read(size);
-		for (auto i = 0; i < size; i++) {
-			Node_t n;
-			socket.Read(n);
-			Distance_t d;
-			socket.Read(d);
-			AddDistance(n, d);
-		}
+		DecodeFields(socket, Fields());
 	}
 
 	virtual void Encode(SocketHelper& socket) const {
-		socket.Write(mapInfo);
-		socket.Write(sourceNode);
-		int size = distances.size();
-		socket.Write(size);
-		for (const auto& p : distances) {
-			socket.Write(p.first);
-			socket.Write(p.second);
-		}
+		EncodeFields(socket, Fields());
 		socket.Flush();
 	}
 
+	// destinations must be added in ascending order
 	void AddDistance(const Node_t& dest, const Distance_t& distance) {
-		distances[dest] = distance;
+		assert(distances.empty() || distances.back().first < dest);
+		distances.emplace_back(dest, distance);
 	}
 
 	void Print() const {
@@ -510,27 +1291,21 @@ protected:
 	AllDelay() {}
 
 public:
-	map<Node_t, Delay> delays;// since all transmission delays are identical, transmission delys can be further reduced to 1 copy.
+	RequestId_t requestId = 0; // copied from the query
+	Status status = Status::Ok;
+	FlatVector<std::pair<Node_t, Delay>> delays;// ascending by destination. since all transmission delays are identical, transmission delys can be further reduced to 1 copy.
+
+	// rejection without result
+	AllDelay(const RequestId_t& _requestId, const Status _status) : requestId(_requestId), status(_status) {}
+
+	MESSAGE_FIELDS(requestId, status, delays)
 
 	AllDelay(SocketHelper& socket) {
-		int size;
-		socket.Read(size);
-		for (auto i = 0; i < size; i++) {
-			Node_t n;
-			socket.Read(n);
-			Delay d;
-			socket.Read(d);
-			AddDelay(n, d);
-		}
+		DecodeFields(socket, Fields());
 	}
 
 	virtual void Encode(SocketHelper& socket) const {
-		int size = delays.size();
-		socket.Write(size);
-		for (const auto& d : delays) {
-			socket.Write(d.first);
-			socket.Write(d.second);
-		}
+		EncodeFields(socket, Fields());
 		socket.Flush();
 	}
 
@@ -548,31 +1323,137 @@ public:
 	}
 
 protected:
+	// destinations must be added in ascending order
 	void AddDelay(const Node_t& dest, const Delay& delay) {
-		delays[dest] = delay;
+		assert(delays.empty() || delays.back().first < dest);
+		delays.emplace_back(dest, delay);
 	}
 };
 
 // Query struct for client query main server and further be forward to server A & B
+// kind of a query to main server or server A, peeked before decoding
+enum class QueryKind : char {
+	Single,
+	Batch,
+	BatchItem, // ClientQuery of one source of a batch, answered as a single query without printing tables
+	Stream, // ClientQuery whose results come back in chunks while they are calculated
+	StreamNext, // ClientQuery from main server asking server A for the next chunks of stream requestId
+};
+
 struct ClientQuery : public Serializable {
+	QueryKind kind = QueryKind::Single;
+	RequestId_t requestId = 0; // assigned by main server for each backend request, unused from client
+	RequestId_t traceId = 0; // assigned by main server to a sampled query and kept in all its requests, 0 means not traced
 	char mapName; // this field is unnecessary for server B, but I will not define a new class for simplicity.
 	Node_t sourceNode; // this field is unnecessary for server B, but I will not define a new class for simplicity.
-	FileSize_t fileSize; // this field is unnecessary for server A, but I will not define a new class for simplicity.
+	Node_t destination = ALL_DESTINATIONS; // point-to-point query when set
+	FileSize_t fileSize; // server A needs it only for maxDelay
+	Timestamp_t deadline = 0; // wall clock, 0 means no deadline
+	mutable Timestamp_t sentAt = 0; // wall clock, stamped by the sender when encoding, for measuring queueing time
+	// bounds, only destinations within all of them are returned; negative or 0 means unbounded
+	Distance_t maxDistance = -1;
+	Delay_t maxDelay = -1; // end-to-end, converted to a distance by server A
+	int k = 0; // nearest destinations, ties broken by smaller vertex
+
+	MESSAGE_FIELDS(kind, requestId, traceId, mapName, sourceNode, destination, fileSize, deadline, sentAt, maxDistance, maxDelay, k)
 
 	ClientQuery(const char _mapName, const Node_t& _sourceNode, const FileSize_t& _fileSize) : mapName(_mapName), sourceNode(_sourceNode), fileSize(_fileSize) {}
 
 	ClientQuery(SocketHelper& socket) {
-		socket.Read(mapName);
-		socket.Read(sourceNode);
-		socket.Read(fileSize);
+		DecodeFields(socket, Fields());
 	}
 
 	virtual void Encode(SocketHelper& socket) const {
-		socket.Write(mapName);
-		socket.Write(sourceNode);
-		socket.Write(fileSize);
+		sentAt = WallClockMicroseconds();
+		EncodeFields(socket, Fields());
 		socket.Flush();
 	}
+
+	// the query followed by payload in one datagram, as server B takes a query with its shortest paths; a single datagram cannot interleave
+	// with those of other senders to the same port
+	void Encode(SocketHelper& socket, const Serializable& payload) const {
+		sentAt = WallClockMicroseconds();
+		EncodeFields(socket, Fields());
+		payload.Encode(socket);
+	}
+
+	bool Expired() const {
+		return deadline != 0 && WallClockMicroseconds() >= deadline;
+	}
+
+	bool Bounded() const {
+		return maxDistance >= 0 || maxDelay >= 0 || k > 0;
+	}
+};
+
+// Query struct for many source vertices of one map, from client to main server and from main server to server A
+struct BatchQuery : public Serializable {
+	QueryKind kind = QueryKind::Batch;
+	RequestId_t requestId = 0; // the reply of sources[i] carries requestId + i
+	RequestId_t traceId = 0; // as in ClientQuery
+	char mapName;
+	FileSize_t fileSize; // unused by server A
+	Timestamp_t deadline = 0; // wall clock, 0 means no deadline
+	mutable Timestamp_t sentAt = 0; // wall clock, stamped by the sender when encoding
+	Distance_t maxDistance = -1; // bounds of every source, as in ClientQuery
+	Delay_t maxDelay = -1;
+	int k = 0;
+	FlatVector<Node_t> sources;
+
+	MESSAGE_FIELDS(kind, requestId, traceId, mapName, fileSize, deadline, sentAt, maxDistance, maxDelay, k, sources)
+
+	BatchQuery(const char _mapName, const FileSize_t& _fileSize) : mapName(_mapName), fileSize(_fileSize) {}
+
+	BatchQuery(SocketHelper& socket) {
+		DecodeFields(socket, Fields());
+	}
+
+	virtual void Encode(SocketHelper& socket) const {
+		sentAt = WallClockMicroseconds();
+		EncodeFields(socket, Fields());
+		socket.Flush();
+	}
+
+	bool Expired() const {
+		return deadline != 0 && WallClockMicroseconds() >= deadline;
+	}
+
+	// the query of one source
+	ClientQuery Single(const size_t index) const {
+		auto query = ClientQuery(mapName, sources[index], fileSize);
+		query.kind = QueryKind::BatchItem;
+		query.traceId = traceId;
+		query.deadline = deadline;
+		query.maxDistance = maxDistance;
+		query.maxDelay = maxDelay;
+		query.k = k;
+		return query;
+	}
+};
+
+// admission control of one stage, rejects queries which have waited in queue longer than the latency budget
+class AdmissionControl {
+private:
+	Timestamp_t queueBudget; // 0 means unlimited
+
+public:
+	long long expiredCount = 0;
+	long long overloadedCount = 0;
+
+	AdmissionControl(const Options& options) : queueBudget(options.GetInt("queue-budget-ms", 0) * 1000) {}
+
+	template <typename Query>
+	Status Admit(const Query& query) {
+		if (query.Expired()) {
+			expiredCount++;
+			return Status::DeadlineExceeded;
+		}
+		if (queueBudget > 0 && WallClockMicroseconds() - query.sentAt > queueBudget) {
+			overloadedCount++;
+			return Status::Overloaded;
+		}
+		return Status::Ok;
+	}
 };
 
 // Response struct for main server response to clinet
@@ -583,50 +1464,174 @@ private:
 	}
 
 public:
-	std::vector<std::tuple<Node_t, Distance_t, Delay>> values; // since all transmission delays are identical, they can be further reduced to 1 copy.
+	Status status = Status::Ok;
+	FlatVector<std::tuple<Node_t, Distance_t, Delay>> values; // since all transmission delays are identical, they can be further reduced to 1 copy.
+
+	// rejection without result
+	explicit Response(const Status _status) : status(_status) {}
 
 	Response(const AllShortestPath& allShortestPath, const AllDelay& allDelay) {
 		if (allShortestPath.distances.size() != allDelay.delays.size()) {
 			throw ResultMappingError();
 		}
-		for (const auto& d : allShortestPath.distances) {
-			auto it = allDelay.delays.find(d.first);
-			if (it == allDelay.delays.end()) {
+		values.reserve(allShortestPath.distances.size());
+		for (size_t i = 0; i < allShortestPath.distances.size(); i++) { // both sorted by destination
+			const auto& d = allShortestPath.distances[i];
+			const auto& delay = allDelay.delays[i];
+			if (d.first != delay.first) {
 				throw ResultMappingError();
 			}
-			Add(std::make_tuple(d.first, d.second, it->second));
+			Add(std::make_tuple(d.first, d.second, delay.second));
 		}
 	}
 
+	MESSAGE_FIELDS(status, values)
+
 	Response(SocketHelper& socket) {
-		int size;
-		socket.Read(size);
-		for (auto i = 0; i < size; i++) {
-			std::tuple<Node_t, Distance_t, Delay> t;
-			socket.Read(t);
-			Add(t);
-		}
+		DecodeFields(socket, Fields());
 	}
 
 	virtual void Encode(SocketHelper& socket) const {
-		int size = values.size();
-		socket.Write(size);
-		for (const auto& v : values) {
-			socket.Write(v);
-		}
+		EncodeFields(socket, Fields());
 		socket.Flush();
 	}
 
-	void Print() const {
+	// table is printed as header, rows and footer, so that a stream can print its rows as they arrive
+	static void PrintHeader() {
+		cout << left;
+		cout << "--------------------------------------------------------------------------------" << endl;
+		cout << setw(13) << "Destination" << setw(13) << "Min Length" << setw(20) << "Tt" << setw(20) << "Tp" << setw(20) << "Delay" << endl;
+		cout << "--------------------------------------------------------------------------------" << endl;
+	}
+
+	static void PrintRows(const std::tuple<Node_t, Distance_t, Delay>* begin, const std::tuple<Node_t, Distance_t, Delay>* end) {
 		const int colWidth[] = { 13, 13, 20, 20, 20 };
 		std::fesetround(FE_TONEAREST);
 		cout << left << std::fixed << std::showpoint << std::setprecision(FLOAT_PRECISION);
-		cout << "--------------------------------------------------------------------------------" << endl;
-		cout << setw(colWidth[0]) << "Destination" << setw(colWidth[1]) << "Min Length" << setw(colWidth[2]) << "Tt" << setw(colWidth[3]) << "Tp" << setw(colWidth[4]) << "Delay" << endl;
-		cout << "--------------------------------------------------------------------------------" << endl;
-		for (const auto& t : values) {
-			cout << setw(colWidth[0]) << std::get<0>(t) << setw(colWidth[1]) << std::get<1>(t) << setw(colWidth[2]) << std::get<2>(t).transmission << setw(colWidth[3]) << std::get<2>(t).propagation << setw(colWidth[4]) << std::get<2>(t).Total() << endl;
+		for (auto t = begin; t != end; t++) {
+			cout << setw(colWidth[0]) << std::get<0>(*t) << setw(colWidth[1]) << std::get<1>(*t) << setw(colWidth[2]) << std::get<2>(*t).transmission << setw(colWidth[3]) << std::get<2>(*t).propagation << setw(colWidth[4]) << std::get<2>(*t).Total() << endl;
 		}
+	}
+
+	static void PrintFooter() {
 		cout << "--------------------------------------------------------------------------------" << endl;
 	}
-};
\ No newline at end of file
+
+	// table of rows [begin, end)
+	static void Print(const std::tuple<Node_t, Distance_t, Delay>* begin, const std::tuple<Node_t, Distance_t, Delay>* end) {
+		PrintHeader();
+		PrintRows(begin, end);
+		PrintFooter();
+	}
+
+	void Print() const {
+		Print(values.data(), values.data() + values.size());
+	}
+};
+
+// part of the shortest paths of a stream, from server A to main server; destinations in the order they were settled
+struct ShortestPathChunk : public Serializable {
+	RequestId_t requestId = 0; // of the stream, same for all its chunks
+	Status status = Status::Ok;
+	int sequence = 0;
+	bool last = true;
+	MapInfo mapInfo;
+	FlatVector<std::pair<Node_t, Distance_t>> distances;
+
+	MESSAGE_FIELDS(requestId, status, sequence, last, mapInfo, distances)
+
+	ShortestPathChunk(const MapInfo& _mapInfo) : mapInfo(_mapInfo) {}
+
+	// rejection without result
+	ShortestPathChunk(const RequestId_t& _requestId, const Status _status) : requestId(_requestId), status(_status) {}
+
+	ShortestPathChunk(SocketHelper& socket) {
+		DecodeFields(socket, Fields());
+	}
+
+	virtual void Encode(SocketHelper& socket) const {
+		EncodeFields(socket, Fields());
+		socket.Flush();
+	}
+};
+
+// part of the response of a stream, from main server to client; the client reads chunks until last
+struct ResponseChunk : public Serializable {
+	Status status = Status::Ok;
+	bool last = true;
+	FlatVector<std::tuple<Node_t, Distance_t, Delay>> values;
+
+	MESSAGE_FIELDS(status, last, values)
+
+	// failure, ends the stream
+	explicit ResponseChunk(const Status _status) : status(_status) {}
+
+	// rows of a chunk of shortest paths with their delays, both in the same order
+	ResponseChunk(const AllShortestPath& allShortestPath, const AllDelay& allDelay, const bool _last) : last(_last) {
+		auto rows = Response(allShortestPath, allDelay);
+		values.assign(rows.values.begin(), rows.values.end());
+	}
+
+	ResponseChunk(SocketHelper& socket) {
+		DecodeFields(socket, Fields());
+	}
+
+	virtual void Encode(SocketHelper& socket) const {
+		EncodeFields(socket, Fields());
+		socket.Flush();
+	}
+};
+
+// Response struct for main server response to client of a batch query, rows of all sources in one list
+struct BatchResponse : public Serializable {
+	Status status = Status::Ok;
+	FlatVector<Node_t> sources;
+	FlatVector<int> counts; // number of rows of each source
+	FlatVector<std::tuple<Node_t, Distance_t, Delay>> values; // rows of sources[0], then rows of sources[1], ...
+
+	MESSAGE_FIELDS(status, sources, counts, values)
+
+	// rejection without result
+	explicit BatchResponse(const Status _status) : status(_status) {}
+
+	BatchResponse(SocketHelper& socket) {
+		DecodeFields(socket, Fields());
+	}
+
+	// results of sources in order
+	BatchResponse(const vector<std::shared_ptr<const AllShortestPath>>& shortestPaths, const vector<AllDelay>& delays) {
+		if (shortestPaths.size() != delays.size()) {
+			throw ResultMappingError();
+		}
+		for (size_t i = 0; i < shortestPaths.size(); i++) {
+			auto response = Response(*shortestPaths[i], delays[i]);
+			sources.push_back(shortestPaths[i]->sourceNode);
+			counts.push_back(response.values.size());
+			values.insert(values.end(), response.values.begin(), response.values.end());
+		}
+	}
+
+	virtual void Encode(SocketHelper& socket) const {
+		EncodeFields(socket, Fields());
+		socket.Flush();
+	}
+
+	void Print() const {
+		auto begin = values.data();
+		for (size_t i = 0; i < sources.size(); i++) {
+			cout << "Start vertex " << sources[i] << ":" << endl;
+			Response::Print(begin, begin + counts[i]);
+			begin += counts[i];
+		}
+	}
+};
+
+// wire layout of fixed sections, changing one breaks compatibility with running peers
+static_assert(ClientQuery::FIXED_SIZE == 78, "ClientQuery layout changed");
+static_assert(BatchQuery::FIXED_SIZE == 66, "BatchQuery layout changed");
+static_assert(AllShortestPath::FIXED_SIZE == 45, "AllShortestPath layout changed");
+static_assert(AllDelay::FIXED_SIZE == 13, "AllDelay layout changed");
+static_assert(Response::FIXED_SIZE == 5, "Response layout changed");
+static_assert(BatchResponse::FIXED_SIZE == 13, "BatchResponse layout changed");
+static_assert(ShortestPathChunk::FIXED_SIZE == 42, "ShortestPathChunk layout changed");
+static_assert(ResponseChunk::FIXED_SIZE == 6, "ResponseChunk layout changed");
\ No newline at end of file
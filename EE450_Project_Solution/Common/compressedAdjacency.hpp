@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const int COMPRESSED_BLOCK_VERTICES = 64; // vertices sharing one start position and one gap width
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// edges of a flat adjacency bit-packed, decoded on the fly by searches; the offsets it was built from stay with the owner
+// and still give the edges of vertex v as [offsets[v], offsets[v + 1]), so the start of any vertex is found without decoding
+// the edges of a vertex are sorted by target and each is a gap then a weight: the first gap is the zigzagged distance
+// from v in vertex index, the rest the distance from the previous target less one; gaps have the width of the widest
+// in their block, weights the width of the range between the lightest and the heaviest edge of the map
+class CompressedAdjacency {
+private:
+	vector<uint64_t> words;
+	uint64_t bitCount = 0;
+	vector<uint64_t> blockStarts; // bit position of the first edge of each block
+	vector<uint8_t> gapBits; // of each block
+	int weightBits = 0;
+	Distance_t lightest = 0;
+	Distance_t heaviest = 0;
+
+	static int BitWidth(const uint64_t value) {
+		return value == 0 ? 0 : 64 - __builtin_clzll(value);
+	}
+
+	static uint64_t Zigzag(const int64_t value) {
+		return value >= 0 ? uint64_t(value) * 2 : uint64_t(-value) * 2 - 1;
+	}
+
+	static int64_t Unzigzag(const uint64_t value) {
+		return (value & 1) == 0 ? int64_t(value / 2) : -int64_t(value / 2) - 1;
+	}
+
+	void Append(const uint64_t value, const int width) {
+		if (width == 0) {
+			return;
+		}
+		auto shift = bitCount & 63;
+		if (shift == 0) {
+			words.push_back(0);
+		}
+		words.back() |= value << shift;
+		if (shift + width > 64) {
+			words.push_back(value >> (64 - shift));
+		}
+		bitCount += width;
+	}
+
+	uint64_t Read(const uint64_t position, const int width) const {
+		if (width == 0) {
+			return 0;
+		}
+		auto shift = position & 63;
+		auto value = words[position >> 6] >> shift;
+		if (shift + width > 64) {
+			value |= words[(position >> 6) + 1] << (64 - shift);
+		}
+		return width == 64 ? value : value & ((uint64_t(1) << width) - 1);
+	}
+
+public:
+	CompressedAdjacency(const vector<int>& offsets, const vector<int>& targets, const vector<Distance_t>& weights) {
+		const auto n = (int)offsets.size() - 1;
+		if (!weights.empty()) {
+			lightest = *std::min_element(weights.begin(), weights.end());
+			heaviest = *std::max_element(weights.begin(), weights.end());
+		}
+		weightBits = BitWidth(uint64_t(heaviest - lightest));
+		vector<std::pair<int, Distance_t>> edges; // of one vertex, by target
+		vector<std::pair<uint64_t, uint64_t>> encoded; // gap and weight of each edge of a block
+		for (auto first = 0; first < n; first += COMPRESSED_BLOCK_VERTICES) {
+			encoded.clear();
+			auto width = 0;
+			for (auto v = first; v < std::min(n, first + COMPRESSED_BLOCK_VERTICES); v++) {
+				edges.clear();
+				for (auto e = offsets[v]; e < offsets[v + 1]; e++) {
+					edges.emplace_back(targets[e], weights[e]);
+				}
+				std::sort(edges.begin(), edges.end());
+				for (size_t i = 0; i < edges.size(); i++) {
+					auto gap = i == 0 ? Zigzag(int64_t(edges[i].first) - v) : uint64_t(edges[i].first - edges[i - 1].first - 1);
+					width = std::max(width, BitWidth(gap));
+					encoded.emplace_back(gap, uint64_t(edges[i].second - lightest));
+				}
+			}
+			blockStarts.push_back(bitCount);
+			gapBits.push_back(width);
+			for (const auto& edge : encoded) {
+				Append(edge.first, width);
+				Append(edge.second, weightBits);
+			}
+		}
+		words.shrink_to_fit();
+	}
+
+	Distance_t Heaviest() const {
+		return heaviest;
+	}
+
+	size_t Bytes() const {
+		return words.capacity() * sizeof(uint64_t) + blockStarts.capacity() * sizeof(uint64_t) + gapBits.capacity();
+	}
+
+	// visit(target, weight) for every edge of v in ascending target order, offsets being those it was built from
+	template <typename Visit>
+	void ForEachEdge(const int v, const vector<int>& offsets, const Visit& visit) const {
+		const auto block = v / COMPRESSED_BLOCK_VERTICES;
+		const auto gapWidth = gapBits[block];
+		const auto edgeWidth = gapWidth + weightBits;
+		auto position = blockStarts[block] + uint64_t(offsets[v] - offsets[block * COMPRESSED_BLOCK_VERTICES]) * edgeWidth;
+		auto target = v;
+		for (auto e = offsets[v]; e < offsets[v + 1]; e++, position += edgeWidth) {
+			auto gap = Read(position, gapWidth);
+			target = e == offsets[v] ? int(v + Unzigzag(gap)) : target + 1 + int(gap);
+			visit(target, lightest + Distance_t(Read(position + gapWidth, weightBits)));
+		}
+	}
+};
\ No newline at end of file
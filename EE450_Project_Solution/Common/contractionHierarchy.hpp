@@ -0,0 +1,355 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <fstream>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const uint32_t HIERARCHY_MAGIC = 0x48434545; // "EECH"
+const uint32_t HIERARCHY_VERSION = 1;
+const int WITNESS_SETTLE_LIMIT = 500; // vertices settled by one witness search when contracting, a missed witness only costs a shortcut
+const int PRIORITY_SETTLE_LIMIT = 50; // same when estimating the priority of a vertex
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// exact distance between two vertices of a static undirected graph by contraction hierarchy (Geisberger et al.)
+// vertices are contracted one by one, shortcuts keep distances among the rest; a query searches upward from both ends
+class ContractionHierarchy {
+private:
+	typedef std::pair<Distance_t, int> Entry;
+	typedef std::priority_queue<Entry, vector<Entry>, std::greater<Entry>> Heap;
+
+	// upward graph, edges of v lead to vertices contracted after v
+	vector<int> offsets;
+	vector<int> targets;
+	vector<Distance_t> weights;
+	size_t shortcutCount = 0;
+
+	// working arrays of one query, kept per thread
+	struct Scratch {
+		vector<Distance_t> distance[2]; // from source, from target
+		vector<int> touched[2];
+		vector<Entry> heap[2];
+	};
+
+	static Scratch& ThreadScratch() {
+		static thread_local Scratch scratch;
+		return scratch;
+	}
+
+	// graph being contracted, adjacency holds remaining vertices only
+	class Builder {
+	private:
+		vector<vector<std::pair<int, Distance_t>>> adjacency;
+		vector<int> deleted; // contracted neighbours, spreads contraction over the graph
+		vector<Distance_t> distance; // of witness search
+		vector<int> touched;
+		vector<Entry> heap;
+		vector<int> targetMark; // vertices the current witness search looks for carry the current stamp
+		int stamp = 0;
+
+		// tentative distances from source avoiding skip, stops beyond bound, after limit settled vertices or once all marked targets are settled
+		void Witness(const int source, const int skip, const Distance_t bound, const int limit, int targets) {
+			for (auto v : touched) {
+				distance[v] = std::numeric_limits<Distance_t>::max();
+			}
+			touched.clear();
+			heap.clear();
+			distance[source] = 0;
+			touched.push_back(source);
+			heap.emplace_back(0, source);
+			const auto later = std::greater<Entry>();
+			for (auto settled = 0; !heap.empty() && settled < limit; settled++) {
+				std::pop_heap(heap.begin(), heap.end(), later);
+				auto top = heap.back();
+				heap.pop_back();
+				if (top.first > bound) {
+					break;
+				}
+				if (top.first > distance[top.second]) {
+					continue;
+				}
+				if (targetMark[top.second] == stamp && --targets == 0) {
+					break;
+				}
+				for (const auto& edge : adjacency[top.second]) {
+					auto newDist = top.first + edge.second;
+					if (edge.first != skip && newDist < distance[edge.first]) {
+						if (distance[edge.first] == std::numeric_limits<Distance_t>::max()) {
+							touched.push_back(edge.first);
+						}
+						distance[edge.first] = newDist;
+						heap.emplace_back(newDist, edge.first);
+						std::push_heap(heap.begin(), heap.end(), later);
+					}
+				}
+			}
+		}
+
+		void AddEdge(const int u, const int w, const Distance_t weight) {
+			for (auto& edge : adjacency[u]) {
+				if (edge.first == w) {
+					edge.second = std::min(edge.second, weight);
+					return;
+				}
+			}
+			adjacency[u].emplace_back(w, weight);
+		}
+
+		void RemoveEdge(const int u, const int w) {
+			auto& edges = adjacency[u];
+			for (size_t i = 0; i < edges.size(); i++) {
+				if (edges[i].first == w) {
+					edges[i] = edges.back();
+					edges.pop_back();
+					return;
+				}
+			}
+		}
+
+	public:
+		Builder(const vector<int>& offsets, const vector<int>& targets, const vector<Distance_t>& weights) :
+			adjacency(offsets.size() - 1), deleted(offsets.size() - 1, 0), distance(offsets.size() - 1, std::numeric_limits<Distance_t>::max()), targetMark(offsets.size() - 1, 0) {
+			for (size_t v = 0; v + 1 < offsets.size(); v++) {
+				for (auto e = offsets[v]; e < offsets[v + 1]; e++) {
+					adjacency[v].emplace_back(targets[e], weights[e]);
+				}
+			}
+		}
+
+		int VertexCount() const {
+			return adjacency.size();
+		}
+
+		const vector<std::pair<int, Distance_t>>& Edges(const int v) const {
+			return adjacency[v];
+		}
+
+		// shortcuts between neighbours of v needed when v is removed, added to the graph when add is set
+		int Shortcuts(const int v, const int limit, const bool add) {
+			const auto& neighbours = adjacency[v]; // shortcuts only change adjacency of the neighbours
+			auto count = 0;
+			for (size_t i = 0; i + 1 < neighbours.size(); i++) {
+				auto bound = Distance_t(0);
+				stamp++;
+				for (auto j = i + 1; j < neighbours.size(); j++) {
+					bound = std::max(bound, neighbours[i].second + neighbours[j].second);
+					targetMark[neighbours[j].first] = stamp;
+				}
+				Witness(neighbours[i].first, v, bound, limit, neighbours.size() - i - 1);
+				for (auto j = i + 1; j < neighbours.size(); j++) {
+					auto via = neighbours[i].second + neighbours[j].second;
+					if (distance[neighbours[j].first] > via) {
+						count++;
+						if (add) {
+							AddEdge(neighbours[i].first, neighbours[j].first, via);
+							AddEdge(neighbours[j].first, neighbours[i].first, via);
+						}
+					}
+				}
+			}
+			return count;
+		}
+
+		// smaller contracts earlier: shortcuts added minus edges removed, plus neighbours already contracted
+		int Priority(const int v) {
+			return Shortcuts(v, PRIORITY_SETTLE_LIMIT, false) - (int)adjacency[v].size() + deleted[v];
+		}
+
+		// remove v, its remaining edges become its upward edges
+		int Contract(const int v) {
+			auto count = Shortcuts(v, WITNESS_SETTLE_LIMIT, true);
+			for (const auto& edge : adjacency[v]) {
+				RemoveEdge(edge.first, v);
+				deleted[edge.first]++;
+			}
+			return count;
+		}
+	};
+
+	// settle the nearest vertex of one direction, relax its upward edges
+	void Step(Scratch& scratch, const int side, Distance_t& best) const {
+		auto& heap = scratch.heap[side];
+		auto& distance = scratch.distance[side];
+		const auto& other = scratch.distance[1 - side];
+		const auto later = std::greater<Entry>();
+		std::pop_heap(heap.begin(), heap.end(), later);
+		auto top = heap.back();
+		heap.pop_back();
+		if (top.first > distance[top.second]) {
+			return;
+		}
+		if (other[top.second] != std::numeric_limits<Distance_t>::max()) {
+			best = std::min(best, top.first + other[top.second]);
+		}
+		for (auto e = offsets[top.second]; e < offsets[top.second + 1]; e++) {
+			auto newDist = top.first + weights[e];
+			if (newDist < distance[targets[e]]) {
+				if (distance[targets[e]] == std::numeric_limits<Distance_t>::max()) {
+					scratch.touched[side].push_back(targets[e]);
+				}
+				distance[targets[e]] = newDist;
+				heap.emplace_back(newDist, targets[e]);
+				std::push_heap(heap.begin(), heap.end(), later);
+			}
+		}
+	}
+
+	template <typename T>
+	static void WriteArray(std::ostream& out, const vector<T>& array) {
+		uint64_t size = array.size();
+		out.write((const char*)&size, sizeof(size));
+		out.write((const char*)array.data(), size * sizeof(T));
+	}
+
+	template <typename T>
+	static bool ReadArray(std::istream& in, vector<T>& array, const uint64_t maxSize) {
+		uint64_t size = 0;
+		if (!in.read((char*)&size, sizeof(size)) || size > maxSize) {
+			return false;
+		}
+		array.resize(size);
+		return (bool)in.read((char*)array.data(), size * sizeof(T));
+	}
+
+public:
+	ContractionHierarchy() {}
+
+	// build from flat adjacency of an undirected graph, edges of vertex v are [offsets[v], offsets[v + 1])
+	ContractionHierarchy(const vector<int>& offsets, const vector<int>& targets, const vector<Distance_t>& weights) {
+		auto builder = Builder(offsets, targets, weights);
+		const auto n = builder.VertexCount();
+		vector<int> priority(n);
+		vector<bool> contracted(n, false);
+		Heap queue;
+		for (auto v = 0; v < n; v++) {
+			priority[v] = builder.Priority(v);
+			queue.emplace(priority[v], v);
+		}
+		vector<vector<std::pair<int, Distance_t>>> upward(n);
+		while (!queue.empty()) {
+			auto top = queue.top();
+			queue.pop();
+			auto v = top.second;
+			if (contracted[v] || top.first != priority[v]) { // stale entry
+				continue;
+			}
+			// lazy update, priorities change as neighbours are contracted
+			priority[v] = builder.Priority(v);
+			if (!queue.empty() && priority[v] > queue.top().first) {
+				queue.emplace(priority[v], v);
+				continue;
+			}
+			upward[v] = builder.Edges(v);
+			shortcutCount += builder.Contract(v);
+			contracted[v] = true;
+			for (const auto& edge : upward[v]) {
+				priority[edge.first] = builder.Priority(edge.first);
+				queue.emplace(priority[edge.first], edge.first);
+			}
+		}
+		this->offsets.assign(1, 0);
+		for (const auto& edges : upward) {
+			for (const auto& edge : edges) {
+				this->targets.push_back(edge.first);
+				this->weights.push_back(edge.second);
+			}
+			this->offsets.push_back(this->targets.size());
+		}
+	}
+
+	int VertexCount() const {
+		return offsets.empty() ? 0 : offsets.size() - 1;
+	}
+
+	// shortcuts added by contraction, each counted once
+	size_t ShortcutCount() const {
+		return shortcutCount;
+	}
+
+	size_t Bytes() const {
+		return offsets.size() * sizeof(int) + targets.size() * (sizeof(int) + sizeof(Distance_t));
+	}
+
+	// length of shortest path between two vertices, max of Distance_t if unreachable
+	Distance_t Distance(const int source, const int target) const {
+		const auto n = VertexCount();
+		const auto infinity = std::numeric_limits<Distance_t>::max();
+		auto& scratch = ThreadScratch();
+		for (auto side = 0; side < 2; side++) {
+			for (auto v : scratch.touched[side]) { // reset before resizing, the last query may have been on a larger map
+				scratch.distance[side][v] = infinity;
+			}
+			scratch.touched[side].clear();
+			scratch.distance[side].resize(n, infinity);
+			scratch.heap[side].clear();
+			auto start = side == 0 ? source : target;
+			scratch.distance[side][start] = 0;
+			scratch.touched[side].push_back(start);
+			scratch.heap[side].emplace_back(0, start);
+		}
+		// both searches only go up, they meet at the highest vertex of the shortest path
+		auto best = infinity;
+		while (true) {
+			auto side = -1;
+			for (auto s = 0; s < 2; s++) {
+				if (!scratch.heap[s].empty() && (side < 0 || scratch.heap[s].front().first < scratch.heap[side].front().first)) {
+					side = s;
+				}
+			}
+			if (side < 0 || scratch.heap[side].front().first >= best) {
+				break;
+			}
+			Step(scratch, side, best);
+		}
+		return best;
+	}
+
+	// fingerprint identifies the graph the hierarchy was built from
+	void Save(const string& filename, const uint64_t fingerprint) const {
+		auto file = std::ofstream(filename, std::ios::binary);
+		file.write((const char*)&HIERARCHY_MAGIC, sizeof(HIERARCHY_MAGIC));
+		file.write((const char*)&HIERARCHY_VERSION, sizeof(HIERARCHY_VERSION));
+		file.write((const char*)&fingerprint, sizeof(fingerprint));
+		uint64_t shortcuts = shortcutCount;
+		file.write((const char*)&shortcuts, sizeof(shortcuts));
+		WriteArray(file, offsets);
+		WriteArray(file, targets);
+		WriteArray(file, weights);
+	}
+
+	// false if the file is missing, broken or built from another graph
+	bool Load(const string& filename, const uint64_t fingerprint) {
+		auto file = std::ifstream(filename, std::ios::binary);
+		uint32_t magic = 0;
+		uint32_t version = 0;
+		uint64_t savedFingerprint = 0;
+		uint64_t shortcuts = 0;
+		if (!file.read((char*)&magic, sizeof(magic)) || !file.read((char*)&version, sizeof(version)) || !file.read((char*)&savedFingerprint, sizeof(savedFingerprint))
+			|| !file.read((char*)&shortcuts, sizeof(shortcuts))) {
+			return false;
+		}
+		if (magic != HIERARCHY_MAGIC || version != HIERARCHY_VERSION || savedFingerprint != fingerprint) {
+			return false;
+		}
+		const auto maxSize = (uint64_t)std::numeric_limits<int>::max();
+		if (!ReadArray(file, offsets, maxSize) || !ReadArray(file, targets, maxSize) || !ReadArray(file, weights, maxSize)
+			|| offsets.empty() || targets.size() != weights.size() || (size_t)offsets.back() != targets.size()) {
+			offsets.clear();
+			return false;
+		}
+		shortcutCount = shortcuts;
+		return true;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// delay calculation logic
+struct DefaultDelay : public AllDelay {
+private:
+	static Delay_t CalcTransmissionDelay(const FileSize_t& fileSize, const MapInfo& mapInfo, const Distance_t& distance) {
+		return (double)fileSize / BYTE_SIZE / mapInfo.transmissionSpeed;
+	}
+
+	static Delay_t CalcPropagationDelay(const MapInfo& mapInfo, const Distance_t& distance) {
+		return distance / mapInfo.propagationSpeed;
+	}
+public:
+	// largest distance whose end-to-end delay is within maxDelay, negative if even the transmission takes longer
+	static Distance_t DistanceWithin(const Delay_t& maxDelay, const FileSize_t& fileSize, const MapInfo& mapInfo) {
+		auto t = CalcTransmissionDelay(fileSize, mapInfo, 0);
+		auto limit = std::floor((maxDelay - t) * mapInfo.propagationSpeed);
+		if (limit >= (double)std::numeric_limits<Distance_t>::max() / 2) {
+			return std::numeric_limits<Distance_t>::max();
+		}
+		auto distance = (Distance_t)std::max(limit, -1.0);
+		// the product may round either way, settle on exactly the comparison server B makes
+		while (t + CalcPropagationDelay(mapInfo, distance + 1) <= maxDelay) {
+			distance++;
+		}
+		while (distance >= 0 && t + CalcPropagationDelay(mapInfo, distance) > maxDelay) {
+			distance--;
+		}
+		return std::max(distance, Distance_t(-1));
+	}
+
+	DefaultDelay(const FileSize_t& fileSize, const AllShortestPath& allShortestPath) {
+		for (const auto& record : allShortestPath.distances) {
+			auto t = CalcTransmissionDelay(fileSize, allShortestPath.mapInfo, record.second);
+			auto p = CalcPropagationDelay(allShortestPath.mapInfo, record.second);
+			AddDelay(record.first, Delay(t, p));
+		}
+	}
+};
\ No newline at end of file
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const int CACHE_LINE_SIZE = 64;
+const int SPIN_LIMIT = 1024; // busy polls before yielding the core
+
+//===============================================//
+//                     Tool                      //
+//===============================================//
+
+// poll ready until true or until monotonic time point (negative waits forever), spinning first then yielding
+template <typename Predicate>
+bool SpinUntil(const Timestamp_t& until, const Predicate& ready) {
+	for (auto spin = 0; !ready(); spin++) {
+		if (spin < SPIN_LIMIT) {
+			continue;
+		}
+		if (until >= 0 && NowMicroseconds() >= until) {
+			return ready();
+		}
+		if (spin < SPIN_LIMIT * 2) {
+			std::this_thread::yield();
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+	return true;
+}
+
+// poll ready through the spin and yield phases of SpinUntil only, false if it is still not true
+template <typename Predicate>
+bool SpinBriefly(const Predicate& ready) {
+	for (auto spin = 0; spin < SPIN_LIMIT * 2; spin++) {
+		if (ready()) {
+			return true;
+		}
+		if (spin >= SPIN_LIMIT) {
+			std::this_thread::yield();
+		}
+	}
+	return ready();
+}
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// one-shot completion set by one thread and awaited by another; the waiter spins briefly, then parks until it is set or until a deadline
+// it does not yield in between, a yield to a busy thread on the same core may not come back before the deadline
+class Completion {
+private:
+	std::atomic<bool> done;
+	std::atomic<bool> parked; // the waiter announced to be parking or parked
+	std::mutex parkMutex;
+	std::condition_variable set;
+
+public:
+	Completion() : done(false), parked(false) {}
+
+	bool Done() const {
+		return done.load(std::memory_order_acquire);
+	}
+
+	void Set() {
+		done.store(true, std::memory_order_release);
+		std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in WaitUntil: either the waiter finds it done or this finds it parking
+		if (parked.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(parkMutex);
+			set.notify_all();
+		}
+	}
+
+	// wait until set or until monotonic time point, negative waits forever; false if not set by then
+	bool WaitUntil(const Timestamp_t& until) {
+		auto ready = [this] { return Done(); };
+		for (auto spin = 0; spin < SPIN_LIMIT; spin++) {
+			if (ready()) {
+				return true;
+			}
+		}
+		std::unique_lock<std::mutex> lock(parkMutex);
+		parked.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (until < 0) {
+			set.wait(lock, ready);
+			return true;
+		}
+		return set.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::microseconds(until)), ready);
+	}
+};
+
+// bounded multi-producer multi-consumer queue, each cell carries a sequence number telling whether it is free or filled (Dmitry Vyukov's design)
+// a consumer finding it empty spins briefly, then parks on a condition variable until a producer wakes it
+template <typename T>
+class MpmcQueue {
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+	char padding0[CACHE_LINE_SIZE]; // keep producers and consumers on different cache lines
+	std::atomic<size_t> enqueuePosition;
+	char padding1[CACHE_LINE_SIZE];
+	std::atomic<size_t> dequeuePosition;
+	char padding2[CACHE_LINE_SIZE];
+	std::atomic<int> parked; // consumers announced to be parking or parked
+	std::mutex parkMutex;
+	std::condition_variable nonEmpty;
+
+public:
+	// capacity must be a power of 2
+	explicit MpmcQueue(const size_t capacity) : cells(new Cell[capacity]), mask(capacity - 1), enqueuePosition(0), dequeuePosition(0), parked(0) {
+		if (capacity < 2 || (capacity & mask) != 0) {
+			throw ArgumentException("Queue capacity should be a power of 2");
+		}
+		for (size_t i = 0; i < capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool TryPush(const T& value) {
+		auto position = enqueuePosition.load(std::memory_order_relaxed);
+		while (true) {
+			auto& cell = cells[position & mask];
+			auto sequence = cell.sequence.load(std::memory_order_acquire);
+			auto diff = (long long)sequence - (long long)position;
+			if (diff == 0) { // cell free, try to claim it
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					cell.data = value;
+					cell.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) { // full
+				return false;
+			} else { // claimed by another producer
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool TryPop(T& value) {
+		auto position = dequeuePosition.load(std::memory_order_relaxed);
+		while (true) {
+			auto& cell = cells[position & mask];
+			auto sequence = cell.sequence.load(std::memory_order_acquire);
+			auto diff = (long long)sequence - (long long)(position + 1);
+			if (diff == 0) { // cell filled, try to claim it
+				if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					value = std::move(cell.data); // so that the cell does not keep what it held
+					cell.sequence.store(position + mask + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) { // empty
+				return false;
+			} else { // claimed by another consumer
+				position = dequeuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// push, waiting while the queue is full, then wake a parked consumer
+	void Push(const T& value) {
+		SpinUntil(-1, [&] { return TryPush(value); });
+		std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in Pop: either the consumer finds the value or this finds it parking
+		if (parked.load(std::memory_order_relaxed) != 0) {
+			std::lock_guard<std::mutex> lock(parkMutex);
+			nonEmpty.notify_one();
+		}
+	}
+
+	// pop, waiting while the queue is empty; an idle consumer costs no wakeups once parked
+	T Pop() {
+		T value;
+		while (!SpinBriefly([&] { return TryPop(value); })) {
+			std::unique_lock<std::mutex> lock(parkMutex);
+			parked.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			auto popped = TryPop(value); // a push before the announcement did not wake anyone
+			if (!popped) {
+				nonEmpty.wait(lock);
+			}
+			parked.fetch_sub(1, std::memory_order_relaxed);
+			if (popped) {
+				break;
+			}
+		}
+		return value;
+	}
+};
\ No newline at end of file
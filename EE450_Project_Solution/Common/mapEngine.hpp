@@ -0,0 +1,1269 @@
+#pragma once
+
+#include <unordered_map>
+#include <map>
+#include <unordered_set>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <regex>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <limits>
+#include <cstdlib>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "common.hpp"
+#include "threadPool.hpp"
+#include "contractionHierarchy.hpp"
+#include "compressedAdjacency.hpp"
+#include "delayEngine.hpp"
+
+using std::unordered_map;
+using std::map;
+using std::unordered_set;
+using std::set;
+using std::cout;
+using std::left;
+using std::setw;
+using std::endl;
+using std::string;
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const string MAP_FILENAME = "map.txt";
+const int DEFAULT_PARALLEL_THRESHOLD = 1000000; // directed edges, below this Dijkstra is faster than any parallel run
+const int DELTA_STEPPING_GRAIN = 256; // vertices relaxed by one task
+const size_t BOUNDED_SORT_FRACTION = 16; // a bounded result with fewer than this fraction of vertices is sorted, else taken in label order
+
+//===============================================//
+//                     Tool                      //
+//===============================================//
+
+// split string to tokens
+vector<string> Split(const string& str, const string& regexStr) {
+	auto regex = std::regex(regexStr);
+	auto begin = std::sregex_token_iterator(str.begin(), str.end(), regex, -1);
+	auto end = std::sregex_token_iterator();
+	return { begin, end };
+}
+
+// number of whitespace separated tokens of line, without the cost of Split
+int CountTokens(const string& line) {
+	auto count = 0;
+	auto inToken = false;
+	for (const auto c : line) {
+		auto space = isspace((unsigned char)c) != 0;
+		count += !space && !inToken;
+		inToken = !space;
+	}
+	return count;
+}
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+class FileNotFoundException : public EE450Exception {
+public:
+	explicit FileNotFoundException(const string& filename) :EE450Exception("Missing file \"" + filename + "\""){}
+};
+
+class MapFormatException : public ArgumentException {
+public:
+	explicit MapFormatException(const int lineNumber, const string& line) : ArgumentException("Worng map format at line " + std::to_string(lineNumber) + ": " + line) {}
+};
+
+class IllegalEdgeException : public ArgumentException{
+public:
+	explicit IllegalEdgeException(const Node_t& src, const Node_t& dest, const Distance_t& dist) : ArgumentException("Illegal edge from " + std::to_string(src) + " to " + std::to_string(dest) + " with distance " + std::to_string(dist)) {}
+};
+
+class EdgeExistedException : public ArgumentException {
+public:
+	explicit EdgeExistedException(const Node_t& src, const Node_t& dest) : ArgumentException("Edge from " + std::to_string(src) + " to " + std::to_string(dest) + " already existed") {}
+};
+
+class MapNotFoundException : public EE450Exception {
+public:
+	explicit MapNotFoundException(const char mapId) :EE450Exception("Map " + string(1, mapId) + " not found") {}
+};
+
+class VertexNotFoundException : public EE450Exception {
+public:
+	explicit VertexNotFoundException(const Node_t& node) :EE450Exception("Vertex " + std::to_string(node) + " not found") {}
+};
+
+// order of vertices in memory, labels seen by callers are unchanged
+enum class VertexOrder {
+	Label, // ascending label
+	Bfs, // breadth first from a lowest degree vertex of each component
+	Rcm, // reverse Cuthill-McKee, breadth first visiting lower degree neighbours first, then reversed
+	Degree, // descending degree, hubs together
+};
+
+VertexOrder ParseVertexOrder(const string& name) {
+	if (name == "none" || name == "label") {
+		return VertexOrder::Label;
+	} else if (name == "bfs") {
+		return VertexOrder::Bfs;
+	} else if (name == "rcm") {
+		return VertexOrder::Rcm;
+	} else if (name == "degree") {
+		return VertexOrder::Degree;
+	}
+	throw ArgumentException("Unknown vertex order " + name + ", expected none, bfs, rcm or degree");
+}
+
+// whether server A answers point-to-point queries from a contraction hierarchy
+enum class HierarchyMode {
+	None, // Dijkstra stopping at the destination
+	Build, // built at load time
+	Persist, // loaded from a file next to the map file, built and saved when missing or stale
+};
+
+HierarchyMode ParseHierarchyMode(const string& name) {
+	if (name == "none") {
+		return HierarchyMode::None;
+	} else if (name == "build") {
+		return HierarchyMode::Build;
+	} else if (name == "persist") {
+		return HierarchyMode::Persist;
+	}
+	throw ArgumentException("Unknown hierarchy mode " + name + ", expected none, build or persist");
+}
+
+// slice of every map kept by one of several cooperating server A processes, vertices are dealt to partitions by label
+struct Partition {
+	int index = 0;
+	int count = 1;
+
+	int Owner(const Node_t& label) const {
+		auto owner = (int)(label % count);
+		return owner < 0 ? owner + count : owner;
+	}
+
+	bool Owns(const Node_t& label) const {
+		return Owner(label) == index;
+	}
+
+	// the whole map in one process
+	bool Whole() const {
+		return count == 1;
+	}
+};
+
+// "index/count", e.g. 0/3 for the first of three partitions
+Partition ParsePartition(const string& text) {
+	Partition partition;
+	auto parts = SplitList(text, '/');
+	try {
+		if (parts.size() != 2) {
+			throw std::invalid_argument(text);
+		}
+		partition.index = std::stoi(parts[0]);
+		partition.count = std::stoi(parts[1]);
+	} catch (...) {
+		throw ArgumentException("Wrong partition " + text + ", expected index/count");
+	}
+	if (partition.count < 1 || partition.index < 0 || partition.index >= partition.count) {
+		throw ArgumentException("Partition index should be between 0 and count - 1");
+	}
+	return partition;
+}
+
+// working arrays of one shortest path calculation, kept per thread and reused by the next calculation
+struct ShortestPathScratch {
+	vector<Distance_t> distance;
+	vector<std::pair<Distance_t, int>> heap;
+
+	// delta-stepping only
+	std::unique_ptr<std::atomic<Distance_t>[]> sharedDistance; // relaxed by several threads at once
+	size_t sharedCapacity = 0;
+	vector<vector<int>> buckets; // bucket i holds vertices with distance in [i * delta, (i + 1) * delta), may be stale
+	vector<int> frontier;
+	vector<int> settled; // vertices removed from current bucket
+	vector<int> seen; // round a vertex was last taken into frontier, to drop duplicates
+	vector<vector<int>> improved; // per worker, vertices whose distance was lowered
+
+	vector<int> order; // vertices in the order Dijkstra settled them
+};
+
+// limits of a bounded query, the search stops once they are reached
+struct SearchBound {
+	Distance_t maxDistance = std::numeric_limits<Distance_t>::max();
+	int k = 0; // nearest destinations only, 0 means all
+};
+
+// how shortest paths are calculated, maps with at least parallelThreshold directed edges run parallel delta-stepping on pool
+struct EngineOptions {
+	ThreadPool* pool = nullptr; // null means always Dijkstra
+	Distance_t delta = 0; // bucket width, 0 means heaviest edge over average degree of the map
+	size_t parallelThreshold = DEFAULT_PARALLEL_THRESHOLD;
+};
+
+class Map {
+	friend class ShortestPathStream;
+	friend class PartitionSearch;
+private:
+	MapInfo mapInfo;
+	unordered_map<Node_t, map<Node_t, Distance_t>> value; // edges while building, cleared by Freeze
+
+	// flat adjacency built by Freeze, vertex index follows ascending label until Reorder
+	vector<Node_t> labels;
+	unordered_map<Node_t, int> indices;
+	int ownedCount = 0; // vertices [0, ownedCount) belong to this partition, the rest are ends of its edges kept by other partitions, without edges
+	vector<int> byLabel; // owned vertex indices in ascending label order, results are emitted in this order
+	vector<int> offsets; // edges of vertex i are [offsets[i], offsets[i + 1])
+	vector<int> targets;
+	vector<Distance_t> weights;
+	std::shared_ptr<const ContractionHierarchy> hierarchy; // for point-to-point queries, built on the arrays above
+	std::shared_ptr<const CompressedAdjacency> compressed; // replaces targets and weights once built by Compress
+
+	static ShortestPathScratch& ThreadScratch() {
+		static thread_local ShortestPathScratch scratch;
+		return scratch;
+	}
+
+	int Degree(const int v) const {
+		return offsets[v + 1] - offsets[v];
+	}
+
+	// vertices by ascending degree, ties by index
+	vector<int> ByAscendingDegree() const {
+		vector<int> order(VertexCount());
+		for (size_t i = 0; i < order.size(); i++) {
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [this](const int a, const int b) { return Degree(a) < Degree(b); });
+		return order;
+	}
+
+	// breadth first numbering of every component, started from its lowest degree vertex; cuthillMcKee visits neighbours by ascending degree
+	vector<int> BreadthFirstOrder(const bool cuthillMcKee) const {
+		const auto n = VertexCount();
+		vector<int> order;
+		order.reserve(n);
+		vector<bool> visited(n, false);
+		vector<int> neighbours;
+		for (auto start : ByAscendingDegree()) {
+			if (visited[start]) {
+				continue;
+			}
+			visited[start] = true;
+			order.push_back(start);
+			for (auto head = order.size() - 1; head < order.size(); head++) {
+				auto u = order[head];
+				neighbours.clear();
+				for (auto e = offsets[u]; e < offsets[u + 1]; e++) {
+					if (!visited[targets[e]]) {
+						visited[targets[e]] = true;
+						neighbours.push_back(targets[e]);
+					}
+				}
+				if (cuthillMcKee) {
+					std::stable_sort(neighbours.begin(), neighbours.end(), [this](const int a, const int b) { return Degree(a) < Degree(b); });
+				}
+				order.insert(order.end(), neighbours.begin(), neighbours.end());
+			}
+		}
+		return order;
+	}
+
+	// move vertex order[i] to index i, edges of each vertex by ascending new index
+	void Renumber(const vector<int>& order) {
+		assert(!compressed);
+		const auto n = VertexCount();
+		vector<int> rank(n);
+		for (auto i = 0; i < n; i++) {
+			rank[order[i]] = i;
+		}
+		vector<Node_t> newLabels(n);
+		vector<int> newOffsets(1, 0);
+		vector<int> newTargets;
+		vector<Distance_t> newWeights;
+		newOffsets.reserve(n + 1);
+		newTargets.reserve(targets.size());
+		newWeights.reserve(weights.size());
+		vector<std::pair<int, Distance_t>> edges;
+		for (auto i = 0; i < n; i++) {
+			auto u = order[i];
+			newLabels[i] = labels[u];
+			edges.clear();
+			for (auto e = offsets[u]; e < offsets[u + 1]; e++) {
+				edges.emplace_back(rank[targets[e]], weights[e]);
+			}
+			std::sort(edges.begin(), edges.end());
+			for (const auto& edge : edges) {
+				newTargets.push_back(edge.first);
+				newWeights.push_back(edge.second);
+			}
+			newOffsets.push_back(newTargets.size());
+		}
+		labels.swap(newLabels);
+		offsets.swap(newOffsets);
+		targets.swap(newTargets);
+		weights.swap(newWeights);
+		for (auto i = 0; i < n; i++) {
+			indices[labels[i]] = i;
+		}
+		for (auto& v : byLabel) {
+			v = rank[v];
+		}
+	}
+
+	void AddDirectedEdge(const Node_t& src, const Node_t& dest, const Distance_t distance) {
+		if (src == dest || distance < 0) {
+			throw IllegalEdgeException(src, dest, distance);
+		}
+		auto ret = value.emplace(src, map<Node_t, Distance_t>());
+		if (!ret.second) {
+			//throw EdgeExistedException(src, dest);
+		}
+		auto& edges = ret.first->second;
+		edges[dest] = distance;
+	}
+public:
+	Map() {}
+	Map(const MapInfo& _mapInfo) : mapInfo(_mapInfo) {}
+
+	void AddUndirectedEdge(const Node_t& src, const Node_t& dest, const Distance_t distance) {
+		AddDirectedEdge(src, dest, distance);
+		AddDirectedEdge(dest, src, distance);
+	}
+
+	// only the directions leaving vertices of partition
+	void AddUndirectedEdge(const Node_t& src, const Node_t& dest, const Distance_t distance, const Partition& partition) {
+		if (partition.Owns(src)) {
+			AddDirectedEdge(src, dest, distance);
+		}
+		if (partition.Owns(dest)) {
+			AddDirectedEdge(dest, src, distance);
+		}
+	}
+
+	// convert edges to flat arrays, no edge can be added afterwards
+	void Freeze() {
+		labels.clear();
+		for (const auto& edgeSet : value) {
+			labels.push_back(edgeSet.first);
+		}
+		std::sort(labels.begin(), labels.end());
+		ownedCount = labels.size();
+		vector<Node_t> foreign; // ends of edges owned by other partitions, none for a whole map
+		for (const auto& edgeSet : value) {
+			for (const auto& edge : edgeSet.second) {
+				if (value.find(edge.first) == value.end()) {
+					foreign.push_back(edge.first);
+				}
+			}
+		}
+		std::sort(foreign.begin(), foreign.end());
+		labels.insert(labels.end(), foreign.begin(), std::unique(foreign.begin(), foreign.end()));
+		indices.clear();
+		for (size_t i = 0; i < labels.size(); i++) {
+			indices[labels[i]] = i;
+		}
+		offsets.assign(1, 0);
+		targets.clear();
+		weights.clear();
+		for (auto i = 0; i < ownedCount; i++) {
+			for (const auto& edge : value.at(labels[i])) {
+				targets.push_back(indices.at(edge.first));
+				weights.push_back(edge.second);
+			}
+			offsets.push_back(targets.size());
+		}
+		offsets.resize(labels.size() + 1, targets.size());
+		value.clear();
+		byLabel.resize(ownedCount);
+		for (size_t i = 0; i < byLabel.size(); i++) {
+			byLabel[i] = i;
+		}
+	}
+
+	// renumber vertices so that neighbours sit close together in memory, after Freeze
+	void Reorder(const VertexOrder order) {
+		hierarchy.reset(); // built on old indices
+		switch (order) {
+		case VertexOrder::Label:
+			break;
+		case VertexOrder::Bfs:
+			Renumber(BreadthFirstOrder(false));
+			break;
+		case VertexOrder::Rcm: {
+			auto cuthillMcKee = BreadthFirstOrder(true);
+			Renumber(vector<int>(cuthillMcKee.rbegin(), cuthillMcKee.rend()));
+			break;
+		}
+		case VertexOrder::Degree: {
+			auto ascending = ByAscendingDegree();
+			std::stable_sort(ascending.begin(), ascending.end(), [this](const int a, const int b) { return Degree(a) > Degree(b); });
+			Renumber(ascending);
+			break;
+		}
+		}
+	}
+
+	const MapInfo& Info() const {
+		return mapInfo;
+	}
+
+	// owned vertices and ends of edges kept by other partitions
+	int VertexCount() const {
+		return labels.size();
+	}
+
+	int OwnedVertexCount() const {
+		return ownedCount;
+	}
+
+	int UndirectedEdgeCount() const {
+		return DirectedEdgeCount() / 2;
+	}
+
+	// edges leaving owned vertices, of both directions of an undirected edge
+	int DirectedEdgeCount() const {
+		return offsets.empty() ? 0 : offsets.back();
+	}
+
+	// memory held by offsets and edges, flat or compressed
+	size_t EdgeBytes() const {
+		return offsets.capacity() * sizeof(int) + (compressed ? compressed->Bytes() : targets.capacity() * sizeof(int) + weights.capacity() * sizeof(Distance_t));
+	}
+
+	// memory held by the adjacency and the hierarchy, nodes of indices estimated
+	size_t Bytes() const {
+		auto indexNode = sizeof(std::pair<const Node_t, int>) + 2 * sizeof(void*);
+		return labels.capacity() * sizeof(Node_t) + indices.size() * indexNode + indices.bucket_count() * sizeof(void*)
+			+ byLabel.capacity() * sizeof(int) + EdgeBytes() + (hierarchy ? hierarchy->Bytes() : 0);
+	}
+
+	// edges bit-packed by CompressedAdjacency, the flat targets and weights are released; after Reorder and the hierarchy, which need them
+	void Compress() {
+		if (compressed) {
+			return;
+		}
+		compressed = std::make_shared<const CompressedAdjacency>(offsets, targets, weights);
+		vector<int>().swap(targets);
+		vector<Distance_t>().swap(weights);
+	}
+
+	bool Compressed() const {
+		return compressed != nullptr;
+	}
+
+	// visit(target, weight) for every edge leaving v, read from the flat arrays or decoded from the compressed ones
+	template <typename Visit>
+	void ForEachEdge(const int v, const Visit& visit) const {
+		if (compressed) {
+			compressed->ForEachEdge(v, offsets, visit);
+			return;
+		}
+		for (auto e = offsets[v]; e < offsets[v + 1]; e++) {
+			visit(targets[e], weights[e]);
+		}
+	}
+
+	// FNV-1a of the flat adjacency, tells whether a saved hierarchy was built from this map
+	uint64_t Fingerprint() const {
+		auto hash = uint64_t(14695981039346656037ULL);
+		auto mix = [&hash](const void* data, const size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash = (hash ^ ((const unsigned char*)data)[i]) * 1099511628211ULL;
+			}
+		};
+		mix(labels.data(), labels.size() * sizeof(Node_t));
+		mix(offsets.data(), offsets.size() * sizeof(int));
+		mix(targets.data(), targets.size() * sizeof(int));
+		mix(weights.data(), weights.size() * sizeof(Distance_t));
+		return hash;
+	}
+
+	void BuildHierarchy() {
+		assert(!compressed);
+		hierarchy = std::make_shared<const ContractionHierarchy>(offsets, targets, weights);
+	}
+
+	// false if the file is missing or was built from another map
+	bool LoadHierarchy(const string& filename) {
+		auto loaded = std::make_shared<ContractionHierarchy>();
+		if (!loaded->Load(filename, Fingerprint()) || loaded->VertexCount() != VertexCount()) {
+			return false;
+		}
+		hierarchy = loaded;
+		return true;
+	}
+
+	void SaveHierarchy(const string& filename) const {
+		hierarchy->Save(filename, Fingerprint());
+	}
+
+	// null until built or loaded
+	const ContractionHierarchy* Hierarchy() const {
+		return hierarchy.get();
+	}
+
+	// average distance in memory between the two ends of an edge, in vertices; lower means better locality
+	double MeanEdgeSpan() const {
+		if (DirectedEdgeCount() == 0) {
+			return 0;
+		}
+		double total = 0;
+		for (auto u = 0; u < VertexCount(); u++) {
+			ForEachEdge(u, [&total, u](const int target, const Distance_t&) {
+				total += std::abs(target - u);
+			});
+		}
+		return total / DirectedEdgeCount();
+	}
+
+	// default bucket width of delta-stepping, heaviest edge over average degree
+	Distance_t DefaultDelta() const {
+		if (DirectedEdgeCount() == 0) {
+			return 1;
+		}
+		auto heaviest = compressed ? compressed->Heaviest() : *std::max_element(weights.begin(), weights.end());
+		return std::max(Distance_t(1), Distance_t(heaviest * VertexCount() / DirectedEdgeCount()));
+	}
+
+	// result is allocated from the arena of current request
+	AllShortestPath CalcShortestPath(const Node_t& src, const EngineOptions& engine = EngineOptions()) const {
+		auto it = indices.find(src);
+		if (it == indices.end()) {
+			throw VertexNotFoundException(src);
+		}
+		const auto source = it->second;
+		const auto n = VertexCount();
+		const auto infinity = std::numeric_limits<Distance_t>::max();
+		auto result = AllShortestPath(mapInfo, src);
+		auto& scratch = ThreadScratch();
+		if (engine.pool != nullptr && (size_t)DirectedEdgeCount() >= engine.parallelThreshold) {
+			DeltaStepping(source, *engine.pool, engine.delta > 0 ? engine.delta : DefaultDelta(), scratch);
+		} else {
+			Dijkstra(source, scratch);
+		}
+		const auto& distance = scratch.distance;
+		// walk vertices in label order, so result is sorted whatever the memory order
+		result.distances.reserve(n - 1);
+		for (auto v : byLabel) {
+			if (v != source && distance[v] != infinity) { // remove source node from result
+				result.AddDistance(labels[v], distance[v]);
+			}
+		}
+		return result;
+	}
+
+	// shortest path from src to dest only, the result has one row, or none if unreachable or the same vertex
+	// answered by the contraction hierarchy when there is one, else by Dijkstra stopping at dest
+	AllShortestPath CalcShortestPathTo(const Node_t& src, const Node_t& dest) const {
+		auto source = indices.find(src);
+		if (source == indices.end()) {
+			throw VertexNotFoundException(src);
+		}
+		auto target = indices.find(dest);
+		if (target == indices.end()) {
+			throw VertexNotFoundException(dest);
+		}
+		auto result = AllShortestPath(mapInfo, src);
+		if (source->second == target->second) {
+			return result;
+		}
+		Distance_t distance;
+		if (hierarchy) {
+			distance = hierarchy->Distance(source->second, target->second);
+		} else {
+			auto& scratch = ThreadScratch();
+			Dijkstra(source->second, scratch, target->second);
+			distance = scratch.distance[target->second];
+		}
+		if (distance != std::numeric_limits<Distance_t>::max()) {
+			result.AddDistance(dest, distance);
+		}
+		return result;
+	}
+
+	// destinations within bound only, ascending by label; the k nearest are taken by distance, ties by smaller label
+	AllShortestPath CalcShortestPathWithin(const Node_t& src, const SearchBound& bound) const {
+		auto it = indices.find(src);
+		if (it == indices.end()) {
+			throw VertexNotFoundException(src);
+		}
+		const auto source = it->second;
+		auto result = AllShortestPath(mapInfo, src);
+		auto& scratch = ThreadScratch();
+		Dijkstra(source, scratch, -1, bound);
+		const auto& distance = scratch.distance;
+		auto& found = scratch.order;
+		if (!found.empty() && found[0] == source) { // remove source node from result
+			found.erase(found.begin());
+		}
+		if (bound.k > 0 && found.size() > (size_t)bound.k) { // vertices tied with the k-th nearest were settled too
+			std::sort(found.begin(), found.end(), [&](const int a, const int b) {
+				return distance[a] != distance[b] ? distance[a] < distance[b] : labels[a] < labels[b];
+			});
+			found.resize(bound.k);
+		}
+		result.distances.reserve(found.size());
+		if (bound.k == 0 && found.size() > labels.size() / BOUNDED_SORT_FRACTION) {
+			// most vertices qualify, walking all in label order beats sorting them; a vertex not settled is beyond the bound
+			for (auto v : byLabel) {
+				if (v != source && distance[v] <= bound.maxDistance) {
+					result.AddDistance(labels[v], distance[v]);
+				}
+			}
+			return result;
+		}
+		std::sort(found.begin(), found.end(), [this](const int a, const int b) { return labels[a] < labels[b]; });
+		for (auto v : found) {
+			result.AddDistance(labels[v], distance[v]);
+		}
+		return result;
+	}
+
+	// distances from source into scratch.distance, unreachable ones stay infinity, settled vertices into scratch.order
+	// stops once target is settled, if given, or once bound is reached; distances beyond the stop are not final
+	void Dijkstra(const int source, ShortestPathScratch& scratch, const int target = -1, const SearchBound& bound = SearchBound()) const {
+		const auto n = VertexCount();
+		const auto infinity = std::numeric_limits<Distance_t>::max();
+		//Dijkstra with a binary heap, stale heap entries are skipped when popped
+		auto& distance = scratch.distance;
+		auto& heap = scratch.heap;
+		auto& order = scratch.order;
+		distance.assign(n, infinity);
+		heap.clear();
+		order.clear();
+		// init
+		distance[source] = 0;
+		heap.emplace_back(0, source);
+		// calc
+		const auto later = std::greater<std::pair<Distance_t, int>>();
+		while (!heap.empty()) {
+			// find nearest
+			std::pop_heap(heap.begin(), heap.end(), later);
+			auto minDist = heap.back().first;
+			auto newNode = heap.back().second;
+			heap.pop_back();
+			if (minDist > distance[newNode]) {
+				continue;
+			}
+			if (newNode == target) {
+				break;
+			}
+			if (minDist > bound.maxDistance || (bound.k > 0 && order.size() > (size_t)bound.k && minDist > distance[order.back()])) { // k nearest and source settled, with their ties
+				break;
+			}
+			order.push_back(newNode);
+			// update
+			ForEachEdge(newNode, [&](const int target, const Distance_t& weight) {
+				auto newDist = minDist + weight;
+				if (newDist < distance[target]) {
+					distance[target] = newDist;
+					heap.emplace_back(newDist, target);
+					std::push_heap(heap.begin(), heap.end(), later);
+				}
+			});
+		}
+	}
+
+	// same distances as Dijkstra, vertices are settled a bucket of width delta at a time and the edges of a bucket are relaxed in parallel (Meyer and Sanders)
+	// light edges (weight <= delta) may refill the current bucket and are relaxed until it stays empty, heavy edges only once per bucket
+	void DeltaStepping(const int source, ThreadPool& pool, const Distance_t delta, ShortestPathScratch& scratch) const {
+		const auto n = VertexCount();
+		const auto infinity = std::numeric_limits<Distance_t>::max();
+		if (scratch.sharedCapacity < (size_t)n) {
+			scratch.sharedDistance.reset(new std::atomic<Distance_t>[n]);
+			scratch.sharedCapacity = n;
+		}
+		auto distance = scratch.sharedDistance.get();
+		for (auto v = 0; v < n; v++) {
+			distance[v].store(infinity, std::memory_order_relaxed);
+		}
+		auto& buckets = scratch.buckets;
+		auto& frontier = scratch.frontier;
+		auto& settled = scratch.settled;
+		auto& seen = scratch.seen;
+		auto& improved = scratch.improved;
+		for (auto& bucket : buckets) {
+			bucket.clear();
+		}
+		seen.assign(n, -1);
+		improved.resize(pool.Size());
+		for (auto& list : improved) {
+			list.clear();
+		}
+
+		// lower distance of target to candidate, atomically against other threads
+		auto relax = [distance](const int target, const Distance_t candidate) {
+			auto current = distance[target].load(std::memory_order_relaxed);
+			while (candidate < current) {
+				if (distance[target].compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+					return true;
+				}
+			}
+			return false;
+		};
+		// relax edges of vertices in list whose weight is light or heavy, then move improved vertices into their buckets
+		auto relaxAll = [&](const vector<int>& list, const bool light) {
+			auto tasks = (list.size() + DELTA_STEPPING_GRAIN - 1) / DELTA_STEPPING_GRAIN;
+			pool.ParallelFor(tasks, [&](const size_t task, const size_t worker) {
+				auto end = std::min(list.size(), (task + 1) * DELTA_STEPPING_GRAIN);
+				for (auto i = task * DELTA_STEPPING_GRAIN; i < end; i++) {
+					auto u = list[i];
+					auto base = distance[u].load(std::memory_order_relaxed);
+					ForEachEdge(u, [&](const int target, const Distance_t& weight) {
+						if ((weight <= delta) == light && relax(target, base + weight)) {
+							improved[worker].push_back(target);
+						}
+					});
+				}
+			});
+			for (auto& list : improved) {
+				for (auto v : list) {
+					auto index = (size_t)(distance[v].load(std::memory_order_relaxed) / delta);
+					if (index >= buckets.size()) {
+						buckets.resize(index + 1);
+					}
+					buckets[index].push_back(v);
+				}
+				list.clear();
+			}
+		};
+
+		distance[source].store(0, std::memory_order_relaxed);
+		buckets.resize(std::max(buckets.size(), size_t(1)));
+		buckets[0].push_back(source);
+		auto round = 0;
+		for (size_t current = 0; current < buckets.size(); current++) {
+			settled.clear();
+			while (!buckets[current].empty()) {
+				// vertices still belonging to this bucket, each once
+				frontier.clear();
+				for (auto v : buckets[current]) {
+					if ((size_t)(distance[v].load(std::memory_order_relaxed) / delta) == current && seen[v] != round) {
+						seen[v] = round;
+						frontier.push_back(v);
+					}
+				}
+				buckets[current].clear();
+				round++;
+				settled.insert(settled.end(), frontier.begin(), frontier.end());
+				relaxAll(frontier, true);
+			}
+			relaxAll(settled, false);
+		}
+
+		scratch.distance.resize(n);
+		for (auto v = 0; v < n; v++) {
+			scratch.distance[v] = distance[v].load(std::memory_order_relaxed);
+		}
+	}
+};
+
+// shortest paths of one source handed out a few destinations at a time, Dijkstra runs only as far as the destinations taken so far
+// keeps its own working arrays, since it lives across requests; a query that needs the whole search first (a destination, k nearest) is calculated at once and drained
+class ShortestPathStream {
+private:
+	std::shared_ptr<const Map> owner; // keeps a lazily loaded map alive after it is evicted, null if the caller owns the map
+	const Map& map;
+	int source;
+	Distance_t maxDistance;
+	vector<Distance_t> distance;
+	vector<std::pair<Distance_t, int>> heap;
+	vector<std::pair<Node_t, Distance_t>> ready; // rows calculated at once, handed out from readyIndex
+	size_t readyIndex = 0;
+
+	// drop stale heap entries on top, and everything once beyond the bound, so that Done is exact
+	void SkipStale() {
+		const auto later = std::greater<std::pair<Distance_t, int>>();
+		while (!heap.empty() && (heap.front().first > distance[heap.front().second] || heap.front().first > maxDistance)) {
+			if (heap.front().first > maxDistance) {
+				heap.clear();
+				break;
+			}
+			std::pop_heap(heap.begin(), heap.end(), later);
+			heap.pop_back();
+		}
+	}
+
+public:
+	// search from src, destinations up to maxDistance
+	ShortestPathStream(const Map& _map, const Node_t& src, const Distance_t& _maxDistance) : map(_map), maxDistance(_maxDistance) {
+		auto it = map.indices.find(src);
+		if (it == map.indices.end()) {
+			throw VertexNotFoundException(src);
+		}
+		source = it->second;
+		distance.assign(map.VertexCount(), std::numeric_limits<Distance_t>::max());
+		distance[source] = 0;
+		heap.emplace_back(0, source);
+	}
+
+	// rows of a result calculated beforehand
+	ShortestPathStream(const Map& _map, const AllShortestPath& result) : map(_map), source(-1), maxDistance(0), ready(result.distances.begin(), result.distances.end()) {}
+
+	ShortestPathStream(const std::shared_ptr<const Map>& _map, const Node_t& src, const Distance_t& _maxDistance) : ShortestPathStream(*_map, src, _maxDistance) {
+		owner = _map;
+	}
+
+	ShortestPathStream(const std::shared_ptr<const Map>& _map, const AllShortestPath& result) : ShortestPathStream(*_map, result) {
+		owner = _map;
+	}
+
+	const MapInfo& Info() const {
+		return map.Info();
+	}
+
+	bool Done() const {
+		return heap.empty() && readyIndex == ready.size();
+	}
+
+	// up to count next destinations appended to rows, in the order they are settled; rows of one call are ascending by destination like any result
+	template <typename Rows>
+	void Next(const size_t count, Rows& rows) {
+		const auto begin = rows.size();
+		for (; readyIndex < ready.size() && rows.size() - begin < count; readyIndex++) {
+			rows.push_back(ready[readyIndex]);
+		}
+		const auto later = std::greater<std::pair<Distance_t, int>>();
+		while (!heap.empty() && rows.size() - begin < count) {
+			std::pop_heap(heap.begin(), heap.end(), later);
+			auto minDist = heap.back().first;
+			auto newNode = heap.back().second;
+			heap.pop_back();
+			if (minDist > distance[newNode]) {
+				continue;
+			}
+			if (minDist > maxDistance) {
+				heap.clear();
+				break;
+			}
+			if (newNode != source) {
+				rows.emplace_back(map.labels[newNode], minDist);
+			}
+			map.ForEachEdge(newNode, [&](const int target, const Distance_t& weight) {
+				auto newDist = minDist + weight;
+				if (newDist < distance[target]) {
+					distance[target] = newDist;
+					heap.emplace_back(newDist, target);
+					std::push_heap(heap.begin(), heap.end(), later);
+				}
+			});
+		}
+		SkipStale();
+		std::sort(rows.begin() + begin, rows.end());
+	}
+};
+
+enum class ReadLineState {
+	Normal,
+	PropagationSpeed,
+	TransmissionSpeed,
+};
+
+// lines of one map in the map file, so that it can be loaded alone
+struct MapSection {
+	std::streamoff begin = 0;
+	std::streamoff end = 0;
+	int firstLine = 1;
+};
+
+// maps are either all built at start, or with --lazy-maps indexed at start and each loaded on its first query,
+// then evicted least recently used first once resident maps exceed --map-budget-mb; a query holds its map by shared pointer,
+// so an evicted map lives until its last query ends and the budget can be exceeded by maps still in use
+class MapManager {
+private:
+	std::unique_ptr<ThreadPool> pool; // threads of parallel shortest path calculation on large maps
+	EngineOptions engine;
+	size_t streamChunkRows;
+	Partition partition;
+	VertexOrder order;
+	HierarchyMode hierarchyMode;
+	bool compress = false;
+	bool lazy = false;
+	size_t budget = 0; // bytes of resident maps when lazy, 0 is unlimited
+	map<char, MapSection> sections; // of every map in the file when lazy
+	mutable std::mutex loadMutex; // one map is loaded at a time, so that queries waiting for the same map load it once
+	mutable std::mutex mutex; // guards the members below when lazy, built maps are never changed
+	mutable map<char, std::shared_ptr<Map>> maps;
+	mutable map<char, uint64_t> lastUsed;
+	mutable map<char, int> loads;
+	mutable uint64_t useClock = 0;
+	mutable size_t residentBytes = 0;
+
+	static string HierarchyFilename(const char map) {
+		return MAP_FILENAME + "." + string(1, map) + ".ch";
+	}
+
+	// contraction hierarchy of a map, reported as built or loaded
+	void PrepareHierarchy(const char id, Map& map) const {
+		if (hierarchyMode == HierarchyMode::None) {
+			return;
+		}
+		auto filename = HierarchyFilename(id);
+		auto start = NowMicroseconds();
+		if (hierarchyMode == HierarchyMode::Persist && map.LoadHierarchy(filename)) {
+			cout << "The Server A has loaded the contraction hierarchy of map " << id << " from " << filename << " in " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+			return;
+		}
+		map.BuildHierarchy();
+		const auto& hierarchy = *map.Hierarchy();
+		cout << "The Server A has built the contraction hierarchy of map " << id << ": " << hierarchy.ShortcutCount() << " shortcuts, "
+			<< hierarchy.Bytes() / 1024 << " KB in " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+		if (hierarchyMode == HierarchyMode::Persist) {
+			map.SaveHierarchy(filename);
+		}
+	}
+
+	// edges of a map bit-packed when --compress-maps, reported in bytes per directed edge against the flat arrays
+	void CompressEdges(const char id, Map& map) const {
+		if (!compress || map.DirectedEdgeCount() == 0) {
+			return;
+		}
+		auto start = NowMicroseconds();
+		auto flat = (double)map.EdgeBytes() / map.DirectedEdgeCount();
+		map.Compress();
+		cout << "The Server A has compressed the edges of map " << id << " from " << flat << " to " << (double)map.EdgeBytes() / map.DirectedEdgeCount()
+			<< " bytes per edge in " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+	}
+
+	// maps of the lines of file, the first being lineNumber + 1, each frozen and handed to store
+	template <typename Store>
+	void ParseMaps(std::istream& file, int lineNumber, const Store& store) const {
+		auto state = ReadLineState::Normal;
+		string name;
+		PropagationSpeed_t pSpeed = 0;
+		TransmissionSpeed_t tSpeed = 0;
+		MapInfo info;
+		Node_t src;
+		Node_t dest;
+		Distance_t dist;
+		Map map;
+		for (string line; getline(file, line);) { // read lines
+			lineNumber++;
+			if (line.size() == 0 || std::all_of(line.begin(), line.end(), isspace)) {// empty line
+				continue;
+			}
+			auto tokens = Split(line, R"(\s+)");
+			try {
+				switch (state) {
+				case ReadLineState::Normal:
+					switch (tokens.size()) {
+					case 1:// new map id
+						if (!name.empty()) {
+							map.Freeze();
+							store(std::move(map)); // store last map
+						}
+						name = tokens[0];
+						state = ReadLineState::PropagationSpeed;
+						break;
+					case 3:// new edge
+						src = std::stoi(tokens[0]);
+						dest = std::stoi(tokens[1]);
+						dist = std::stoi(tokens[2]);
+						map.AddUndirectedEdge(src, dest, dist, partition);
+						break;
+					default:
+						throw std::invalid_argument(line);
+					}
+					break;
+				case ReadLineState::PropagationSpeed:
+					pSpeed = std::stod(tokens[0]);
+					state = ReadLineState::TransmissionSpeed;
+					break;
+				case ReadLineState::TransmissionSpeed:
+					tSpeed = std::stod(tokens[0]);
+					assert(name.size() == 1);
+					info = MapInfo(name[0], pSpeed, tSpeed); // assembly map info
+					map = Map(info);
+					state = ReadLineState::Normal;
+					break;
+				}
+			} catch (...) {
+				throw MapFormatException(lineNumber, line);
+			}
+		}
+		map.Freeze();
+		store(std::move(map)); // store last map
+	}
+
+	void BuildFromFile(const string& filename) {
+		maps.clear();
+		auto file = std::ifstream(filename);
+		if (!file.is_open()) {
+			throw FileNotFoundException(filename);
+		}
+		ParseMaps(file, 0, [this](Map&& map) {
+			maps[map.Info().name] = std::make_shared<Map>(std::move(map));
+		});
+	}
+
+	// section of every map in the file, found by counting the tokens of each line: a map starts at a line of one token
+	// that is not one of the two speed lines after the previous start
+	void IndexFile(const string& filename) {
+		auto file = std::ifstream(filename, std::ios::binary);
+		if (!file.is_open()) {
+			throw FileNotFoundException(filename);
+		}
+		MapSection* last = nullptr;
+		auto offset = std::streamoff(0);
+		auto lineNumber = 0;
+		auto speedLines = 0; // still to skip after the start of a map
+		for (string line; getline(file, line); offset += line.size() + 1) {
+			lineNumber++;
+			auto tokens = CountTokens(line);
+			if (tokens == 0) {
+				continue;
+			}
+			if (speedLines > 0) {
+				speedLines--;
+				continue;
+			}
+			if (tokens != 1) {
+				continue;
+			}
+			if (last != nullptr) {
+				last->end = offset;
+			}
+			last = &sections[line[line.find_first_not_of(" \t\r\v\f")]];
+			last->begin = offset;
+			last->firstLine = lineNumber;
+			speedLines = 2;
+		}
+		if (last != nullptr) {
+			last->end = offset;
+		}
+	}
+
+	// one map of the file, prepared like maps built at start
+	std::shared_ptr<Map> Load(const char id, const MapSection& section) const {
+		auto file = std::ifstream(MAP_FILENAME, std::ios::binary);
+		if (!file.is_open()) {
+			throw FileNotFoundException(MAP_FILENAME);
+		}
+		string text(section.end - section.begin, '\0');
+		file.seekg(section.begin);
+		file.read(&text[0], text.size());
+		text.resize(file.gcount());
+		auto lines = std::istringstream(text);
+		std::shared_ptr<Map> loaded;
+		ParseMaps(lines, section.firstLine - 1, [&loaded](Map&& map) {
+			loaded = std::make_shared<Map>(std::move(map));
+		});
+		loaded->Reorder(order);
+		PrepareHierarchy(id, *loaded);
+		CompressEdges(id, *loaded);
+		return loaded;
+	}
+
+	// the map if resident, marked as just used
+	std::shared_ptr<Map> Resident(const char id) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = maps.find(id);
+		if (it == maps.end()) {
+			return nullptr;
+		}
+		lastUsed[id] = ++useClock;
+		return it->second;
+	}
+
+	// least recently used maps dropped until resident maps fit the budget, never keep; called with mutex held
+	void Evict(const char keep) const {
+		while (budget > 0 && residentBytes > budget && maps.size() > 1) {
+			auto victim = lastUsed.end();
+			for (auto it = lastUsed.begin(); it != lastUsed.end(); ++it) {
+				if (it->first != keep && (victim == lastUsed.end() || it->second < victim->second)) {
+					victim = it;
+				}
+			}
+			auto bytes = maps[victim->first]->Bytes();
+			residentBytes -= bytes;
+			cout << "The Server A has evicted map " << victim->first << ", used least recently, freeing " << bytes / 1024 << " KB." << endl;
+			maps.erase(victim->first);
+			lastUsed.erase(victim);
+		}
+	}
+
+	// a map kept in memory, loaded first when lazy
+	std::shared_ptr<const Map> Acquire(const char id) const {
+		if (!lazy) {
+			auto it = maps.find(id);
+			if (it == maps.end()) {
+				throw MapNotFoundException(id);
+			}
+			return it->second;
+		}
+		auto resident = Resident(id);
+		if (resident) {
+			return resident;
+		}
+		auto section = sections.find(id);
+		if (section == sections.end()) {
+			throw MapNotFoundException(id);
+		}
+		std::lock_guard<std::mutex> loadLock(loadMutex);
+		resident = Resident(id);
+		if (resident) { // loaded by another query while this one waited
+			return resident;
+		}
+		auto start = NowMicroseconds();
+		auto loaded = Load(id, section->second);
+		auto latency = NowMicroseconds() - start;
+		auto bytes = loaded->Bytes();
+		std::lock_guard<std::mutex> lock(mutex);
+		maps[id] = loaded;
+		lastUsed[id] = ++useClock;
+		residentBytes += bytes;
+		cout << "The Server A has loaded map " << id << " (load " << ++loads[id] << ") in " << latency / 1000.0 << " ms: " << loaded->VertexCount() << " vertices, "
+			<< loaded->UndirectedEdgeCount() << " edges, " << bytes / 1024 << " KB." << endl;
+		Evict(id);
+		cout << "The Server A keeps " << maps.size() << " of " << sections.size() << " maps in memory, " << residentBytes / 1024 << " KB";
+		if (budget > 0) {
+			cout << " of a budget of " << budget / 1024 << " KB";
+		}
+		cout << "." << endl;
+		return loaded;
+	}
+
+	void Print() const {
+		const int colWidth[] = { 8, 14, 11 };
+		cout << left;
+		if (!partition.Whole()) {
+			cout << "The Server A keeps partition " << partition.index << " of " << partition.count << " of every map, edges are counted leaving its vertices." << endl;
+		}
+		cout << "The Server A has constructed a list of " << maps.size() << " maps:" << endl;
+		cout << "-------------------------------------------" << endl;
+		cout << setw(colWidth[0]) << "Map ID" << setw(colWidth[1]) << "Num Vertices" << setw(colWidth[2]) << "Num Edges" << endl;
+		cout << "-------------------------------------------" << endl;
+		for (const auto& m : maps) {
+			cout << setw(colWidth[0]) << m.first << setw(colWidth[1]) << m.second->OwnedVertexCount() << setw(colWidth[2]) << (partition.Whole() ? m.second->UndirectedEdgeCount() : m.second->DirectedEdgeCount()) << endl;
+		}
+		cout << "-------------------------------------------" << endl;
+	}
+
+	// maps found by IndexFile, sized by their lines in the file
+	void PrintIndex(const Timestamp_t& elapsed) const {
+		const int colWidth[] = { 8, 14 };
+		cout << left;
+		cout << "The Server A has indexed " << sections.size() << " maps in " << elapsed / 1000.0 << " ms, each is loaded on its first query:" << endl;
+		cout << "-------------------------------------------" << endl;
+		cout << setw(colWidth[0]) << "Map ID" << setw(colWidth[1]) << "Text KB" << endl;
+		cout << "-------------------------------------------" << endl;
+		for (const auto& s : sections) {
+			cout << setw(colWidth[0]) << s.first << setw(colWidth[1]) << (s.second.end - s.second.begin) / 1024.0 << endl;
+		}
+		cout << "-------------------------------------------" << endl;
+	}
+
+public:
+	MapManager(const Options& options) : pool(new ThreadPool(options.GetInt("sssp-threads", std::max(1u, std::thread::hardware_concurrency())))) {
+		engine.pool = pool.get();
+		engine.delta = options.GetInt("delta", 0);
+		engine.parallelThreshold = options.GetInt("parallel-threshold", DEFAULT_PARALLEL_THRESHOLD);
+		auto chunkRows = options.GetInt("stream-chunk", DEFAULT_STREAM_CHUNK_ROWS);
+		if (chunkRows <= 0 || chunkRows > MAX_STREAM_CHUNK_ROWS) {
+			throw ArgumentException("Stream chunk should be between 1 and " + std::to_string(MAX_STREAM_CHUNK_ROWS) + " destinations");
+		}
+		streamChunkRows = chunkRows;
+		order = ParseVertexOrder(options.Get("reorder", "none"));
+		hierarchyMode = ParseHierarchyMode(options.Get("ch", "none"));
+		partition = ParsePartition(options.Get("partition", "0/1"));
+		compress = options.Has("compress-maps");
+		if (!partition.Whole() && (order != VertexOrder::Label || hierarchyMode != HierarchyMode::None)) {
+			throw ArgumentException("Reorder and contraction hierarchy need the whole map, they cannot be used with partition");
+		}
+		auto budgetMb = options.GetDouble("map-budget-mb", 0);
+		if (budgetMb < 0) {
+			throw ArgumentException("Map budget should not be negative");
+		}
+		budget = (size_t)(budgetMb * 1024 * 1024);
+		lazy = options.Has("lazy-maps") || budget > 0;
+		if (lazy && !partition.Whole()) {
+			throw ArgumentException("Partition searches keep their map across rounds, lazy maps cannot be used with partition");
+		}
+		if (lazy) {
+			auto start = NowMicroseconds();
+			IndexFile(MAP_FILENAME);
+			PrintIndex(NowMicroseconds() - start);
+			return;
+		}
+		BuildFromFile(MAP_FILENAME);
+		for (auto& m : maps) {
+			m.second->Reorder(order);
+		}
+		Print();
+		for (auto& m : maps) {
+			PrepareHierarchy(m.first, *m.second);
+			CompressEdges(m.first, *m.second);
+		}
+	}
+
+	// valid while the map is resident, which is for good unless maps are lazy; partition searches hold maps this way and are never lazy
+	const Map& Find(const char map) const {
+		return *Acquire(map);
+	}
+
+	// slice of every map kept by this process
+	const Partition& OwnPartition() const {
+		return partition;
+	}
+
+	AllShortestPath CalcShortestPath(const char map, const Node_t& src) const {
+		return Acquire(map)->CalcShortestPath(src, engine);
+	}
+
+	// bounds of query on map, a delay bound becomes a distance bound with the file size of the query
+	static SearchBound Bound(const ClientQuery& query, const MapInfo& info) {
+		SearchBound bound;
+		if (query.maxDistance >= 0) {
+			bound.maxDistance = query.maxDistance;
+		}
+		if (query.maxDelay >= 0) {
+			bound.maxDistance = std::min(bound.maxDistance, DefaultDelay::DistanceWithin(query.maxDelay, query.fileSize, info));
+		}
+		bound.k = std::max(query.k, 0);
+		return bound;
+	}
+
+	// only the destination of query if it has one, else all destinations within its bounds
+	AllShortestPath CalcShortestPath(const ClientQuery& query) const {
+		auto map = Acquire(query.mapName);
+		if (query.destination != ALL_DESTINATIONS) {
+			auto result = map->CalcShortestPathTo(query.sourceNode, query.destination);
+			if (!result.distances.empty() && result.distances[0].second > Bound(query, map->Info()).maxDistance) {
+				result.distances.clear();
+			}
+			return result;
+		}
+		if (!query.Bounded()) {
+			return map->CalcShortestPath(query.sourceNode, engine);
+		}
+		return map->CalcShortestPathWithin(query.sourceNode, Bound(query, map->Info()));
+	}
+
+	// stream of the results of query, calculated as they are taken unless a destination or k nearest need the whole search first
+	std::unique_ptr<ShortestPathStream> OpenStream(const ClientQuery& query) const {
+		auto map = Acquire(query.mapName);
+		if (query.destination != ALL_DESTINATIONS || query.k > 0) {
+			return std::unique_ptr<ShortestPathStream>(new ShortestPathStream(map, CalcShortestPath(query)));
+		}
+		return std::unique_ptr<ShortestPathStream>(new ShortestPathStream(map, query.sourceNode, Bound(query, map->Info()).maxDistance));
+	}
+
+	// stream of a result calculated elsewhere, e.g. across partitions
+	std::unique_ptr<ShortestPathStream> OpenStream(const AllShortestPath& result) const {
+		return std::unique_ptr<ShortestPathStream>(new ShortestPathStream(Acquire(result.mapInfo.name), result));
+	}
+
+	// destinations per chunk of a stream
+	size_t StreamChunkRows() const {
+		return streamChunkRows;
+	}
+};
\ No newline at end of file
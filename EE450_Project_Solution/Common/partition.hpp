@@ -0,0 +1,489 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <functional>
+
+#include "common.hpp"
+#include "sharedMemory.hpp"
+#include "mapEngine.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const int PARTITION_BASE_PORT = 25943; // partition i listens to the others on this port + i
+const int PARTITION_PAGE_ROWS = 1024; // distances per datagram between partitions
+const int PARTITION_REPLY_TIMEOUT_MILLISECONDS = 5000;
+const Timestamp_t PARTITION_IDLE_TIMEOUT = 10000000; // microseconds without a request before a search of a partition is dropped
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+class PartitionUnavailableException : public EE450Exception {
+public:
+	PartitionUnavailableException(const int index, const string& reason) : EE450Exception("Partition " + std::to_string(index) + " " + reason) {}
+};
+
+enum class PartitionAction : char {
+	Update, // lower distances of vertices of the partition
+	Step, // Update, then settle vertices up to threshold; the reply carries the first page of lowered distances of vertices of other partitions
+	Fetch, // next page of the lowered distances of the last step
+	Collect, // page of the final distances of vertices of the partition, ascending by vertex
+	Close, // drop the search, no reply
+};
+
+// from partition 0, which runs the search, to the partition holding the vertices
+struct PartitionRequest : public Serializable {
+	RequestId_t requestId = 0; // of the search, same for all its requests
+	int sequence = 0; // copied to the reply, tells a late reply apart
+	PartitionAction action = PartitionAction::Update;
+	char mapName = 0;
+	Distance_t maxDistance = std::numeric_limits<Distance_t>::max(); // vertices beyond are not searched
+	Distance_t threshold = std::numeric_limits<Distance_t>::max(); // Step only
+	int page = 0; // Fetch and Collect only
+	FlatVector<std::pair<Node_t, Distance_t>> distances; // Update and Step only
+
+	MESSAGE_FIELDS(requestId, sequence, action, mapName, maxDistance, threshold, page, distances)
+
+	PartitionRequest(const RequestId_t& _requestId, const PartitionAction _action, const char _mapName, const Distance_t& _maxDistance)
+		: requestId(_requestId), action(_action), mapName(_mapName), maxDistance(_maxDistance) {}
+
+	PartitionRequest(SocketHelper& socket) {
+		DecodeFields(socket, Fields());
+	}
+
+	virtual void Encode(SocketHelper& socket) const {
+		EncodeFields(socket, Fields());
+		socket.Flush();
+	}
+};
+
+struct PartitionReply : public Serializable {
+	RequestId_t requestId = 0;
+	int sequence = 0;
+	Status status = Status::Ok; // Unavailable if the partition has no such map
+	bool last = true; // no more pages
+	Distance_t minPending = std::numeric_limits<Distance_t>::max(); // Step only, nearest vertex left beyond threshold
+	bool missing = false; // Update and Step only, a vertex of the request is not in the map, which can only be the source
+	FlatVector<std::pair<Node_t, Distance_t>> distances;
+
+	MESSAGE_FIELDS(requestId, sequence, status, last, minPending, missing, distances)
+
+	explicit PartitionReply(const PartitionRequest& request) : requestId(request.requestId), sequence(request.sequence) {}
+
+	PartitionReply(SocketHelper& socket) {
+		DecodeFields(socket, Fields());
+	}
+
+	virtual void Encode(SocketHelper& socket) const {
+		EncodeFields(socket, Fields());
+		socket.Flush();
+	}
+};
+
+static_assert(PartitionRequest::FIXED_SIZE == 38, "PartitionRequest layout changed");
+static_assert(PartitionReply::FIXED_SIZE == 27, "PartitionReply layout changed");
+
+// the part of one search on the vertices of this partition, label-correcting Dijkstra over steps
+// a vertex settled in an earlier step is settled again when another partition lowers its distance, so the distances are exact once no partition has anything left
+class PartitionSearch {
+private:
+	const Map& map;
+	Distance_t maxDistance;
+	vector<Distance_t> distance; // owned vertices, then the lowest distance sent to other partitions for their vertices
+	vector<std::pair<Distance_t, int>> heap;
+	vector<bool> lowered; // foreign vertices lowered in current step
+	vector<int> loweredVertices;
+	vector<std::pair<Node_t, Distance_t>> outbox; // lowered distances of foreign vertices in the last step
+	vector<std::pair<Node_t, Distance_t>> result; // final distances, built by Collect
+
+	void Lower(const int v, const Distance_t& candidate) {
+		if (candidate > maxDistance || candidate >= distance[v]) {
+			return;
+		}
+		distance[v] = candidate;
+		if (v < map.ownedCount) {
+			heap.emplace_back(candidate, v);
+			std::push_heap(heap.begin(), heap.end(), std::greater<std::pair<Distance_t, int>>());
+		} else if (!lowered[v]) {
+			lowered[v] = true;
+			loweredVertices.push_back(v);
+		}
+	}
+
+	static void Page(const vector<std::pair<Node_t, Distance_t>>& rows, const int page, PartitionReply& reply) {
+		auto begin = std::min(rows.size(), (size_t)page * PARTITION_PAGE_ROWS);
+		auto end = std::min(rows.size(), begin + PARTITION_PAGE_ROWS);
+		reply.distances.assign(rows.begin() + begin, rows.begin() + end);
+		reply.last = end == rows.size();
+	}
+
+public:
+	PartitionSearch(const Map& _map, const Distance_t& _maxDistance) : map(_map), maxDistance(_maxDistance),
+		distance(_map.VertexCount(), std::numeric_limits<Distance_t>::max()), lowered(_map.VertexCount(), false) {}
+
+	// distances from other partitions, of vertices of this one; false if a vertex is not in the map, which is then ignored
+	template <typename Rows>
+	bool Update(const Rows& rows) {
+		auto found = true;
+		for (const auto& row : rows) {
+			auto it = map.indices.find(row.first);
+			if (it != map.indices.end() && it->second < map.ownedCount) {
+				Lower(it->second, row.second);
+			} else {
+				found = false;
+			}
+		}
+		return found;
+	}
+
+	// settle vertices up to threshold
+	void Step(const Distance_t& threshold) {
+		const auto later = std::greater<std::pair<Distance_t, int>>();
+		while (!heap.empty() && heap.front().first <= threshold) {
+			std::pop_heap(heap.begin(), heap.end(), later);
+			auto minDist = heap.back().first;
+			auto u = heap.back().second;
+			heap.pop_back();
+			if (minDist > distance[u]) {
+				continue;
+			}
+			map.ForEachEdge(u, [this, &minDist](const int target, const Distance_t& weight) {
+				Lower(target, minDist + weight);
+			});
+		}
+		outbox.clear();
+		for (auto v : loweredVertices) {
+			outbox.emplace_back(map.labels[v], distance[v]);
+			lowered[v] = false;
+		}
+		loweredVertices.clear();
+	}
+
+	// nearest vertex waiting beyond the last threshold, infinity if none
+	Distance_t MinPending() {
+		const auto later = std::greater<std::pair<Distance_t, int>>();
+		while (!heap.empty() && heap.front().first > distance[heap.front().second]) {
+			std::pop_heap(heap.begin(), heap.end(), later);
+			heap.pop_back();
+		}
+		return heap.empty() ? std::numeric_limits<Distance_t>::max() : heap.front().first;
+	}
+
+	void Outbox(const int page, PartitionReply& reply) const {
+		Page(outbox, page, reply);
+	}
+
+	void Collect(const int page, PartitionReply& reply) {
+		if (page == 0) {
+			result.clear();
+			for (auto v = 0; v < map.ownedCount; v++) { // owned vertices are in ascending label order
+				if (distance[v] != std::numeric_limits<Distance_t>::max()) {
+					result.emplace_back(map.labels[v], distance[v]);
+				}
+			}
+		}
+		Page(result, page, reply);
+	}
+};
+
+// searches on the vertices of this partition, driven by the requests of partition 0
+class PartitionSearches {
+private:
+	struct Entry {
+		std::unique_ptr<PartitionSearch> search;
+		Timestamp_t lastUsed;
+	};
+
+	map<RequestId_t, Entry> searches;
+
+public:
+	// reply to request, false for Close which has none
+	bool Handle(const MapManager& manager, const PartitionRequest& request, PartitionReply& reply) {
+		if (request.action == PartitionAction::Close) {
+			searches.erase(request.requestId);
+			return false;
+		}
+		auto it = searches.find(request.requestId);
+		if (it == searches.end()) {
+			if (request.action == PartitionAction::Fetch || request.action == PartitionAction::Collect) { // nothing reached this partition
+				return true;
+			}
+			try {
+				auto search = std::unique_ptr<PartitionSearch>(new PartitionSearch(manager.Find(request.mapName), request.maxDistance));
+				it = searches.emplace(request.requestId, Entry{ std::move(search), 0 }).first;
+			} catch (const MapNotFoundException&) {
+				reply.status = Status::Unavailable;
+				return true;
+			}
+		}
+		it->second.lastUsed = NowMicroseconds();
+		auto& search = *it->second.search;
+		switch (request.action) {
+		case PartitionAction::Update:
+			reply.missing = !search.Update(request.distances);
+			break;
+		case PartitionAction::Step:
+			reply.missing = !search.Update(request.distances);
+			search.Step(request.threshold);
+			reply.minPending = search.MinPending();
+			search.Outbox(0, reply);
+			break;
+		case PartitionAction::Fetch:
+			search.Outbox(request.page, reply);
+			break;
+		case PartitionAction::Collect:
+			search.Collect(request.page, reply);
+			break;
+		case PartitionAction::Close:
+			break;
+		}
+		return true;
+	}
+
+	// drop searches partition 0 has given up on
+	void Expire() {
+		auto now = NowMicroseconds();
+		for (auto it = searches.begin(); it != searches.end();) {
+			if (now - it->second.lastUsed > PARTITION_IDLE_TIMEOUT) {
+				it = searches.erase(it);
+			} else {
+				it++;
+			}
+		}
+	}
+};
+
+// ports between partitions, from --partition-ports or following PARTITION_BASE_PORT
+vector<string> PartitionPorts(const Options& options, const Partition& partition) {
+	auto ports = options.GetList("partition-ports", "");
+	if (ports.empty()) {
+		for (auto i = 0; i < partition.count; i++) {
+			ports.push_back(std::to_string(PARTITION_BASE_PORT + i));
+		}
+	}
+	if ((int)ports.size() != partition.count) {
+		throw ArgumentException("Partition ports should list one port per partition");
+	}
+	return ports;
+}
+
+// server A holding partition 1 or above, answers only partition 0
+class PartitionWorker {
+private:
+	Partition partition;
+	vector<string> ports;
+	std::unique_ptr<DatagramReceiveHelper> receiveHelper;
+	std::unique_ptr<SocketHelper> sendHelper; // to partition 0
+	PartitionSearches searches;
+
+public:
+	PartitionWorker(const Options& options) : partition(ParsePartition(options.Get("partition", "0/1"))), ports(PartitionPorts(options, partition)),
+		receiveHelper(OpenDatagramReceiver(options, ports[partition.index])), sendHelper(receiveHelper->SendHelper(HOST, ports[0].c_str())) {
+		cout << "The Server A partition " << partition.index << " of " << partition.count << " is up and running using UDP on port " << ports[partition.index] << "." << endl;
+	}
+
+	void Serve(const MapManager& manager) {
+		while (true) {
+			if (!receiveHelper->Wait(PARTITION_REPLY_TIMEOUT_MILLISECONDS)) {
+				searches.Expire();
+				continue;
+			}
+			RequestArenaScope arenaScope;
+			auto request = PartitionRequest(*receiveHelper);
+			auto reply = PartitionReply(request);
+			if (searches.Handle(manager, request, reply)) {
+				reply.Encode(*sendHelper);
+			}
+		}
+	}
+};
+
+// runs a query of server A across all partitions, as partition 0 (bulk synchronous: every round delivers the distances lowered in the last round, then each partition settles its vertices up to a common threshold)
+// the own vertices are searched here, the others by request; queries run one at a time
+class PartitionCoordinator {
+private:
+	typedef std::function<void(const int part, const PartitionRequest& request, const PartitionReply& reply)> ReplyHandler;
+
+	Partition partition;
+	vector<string> ports;
+	Distance_t delta; // threshold of a round over the nearest vertex left, 0 means no threshold
+	std::unique_ptr<DatagramReceiveHelper> receiveHelper; // replies of the other partitions
+	vector<std::unique_ptr<SocketHelper>> sendHelpers;
+	PartitionSearches local;
+	std::mutex mutex;
+	RequestId_t nextRequestId;
+	int nextSequence = 0;
+
+	// send the first request of each queue, handle the own one meanwhile, and wait for the replies; handlers may queue more, until all queues are empty
+	void Exchange(const MapManager& manager, vector<std::deque<PartitionRequest>>& queues, const ReplyHandler& onReply) {
+		vector<int> sequences(partition.count, -1);
+		while (true) {
+			auto waiting = 0;
+			for (auto p = 1; p < partition.count; p++) {
+				if (!queues[p].empty()) {
+					queues[p].front().sequence = sequences[p] = nextSequence++;
+					queues[p].front().Encode(*sendHelpers[p]);
+					waiting++;
+				}
+			}
+			auto localWork = !queues[0].empty();
+			if (localWork) {
+				auto request = std::move(queues[0].front());
+				queues[0].pop_front();
+				auto reply = PartitionReply(request);
+				local.Handle(manager, request, reply);
+				onReply(0, request, reply);
+			}
+			if (waiting == 0 && !localWork) {
+				return;
+			}
+			while (waiting > 0) {
+				if (!receiveHelper->Wait(PARTITION_REPLY_TIMEOUT_MILLISECONDS)) {
+					auto part = std::find_if(sequences.begin() + 1, sequences.end(), [](const int sequence) { return sequence >= 0; }) - sequences.begin();
+					throw PartitionUnavailableException(part, "did not reply within " + std::to_string(PARTITION_REPLY_TIMEOUT_MILLISECONDS) + " ms");
+				}
+				auto reply = PartitionReply(*receiveHelper);
+				auto part = std::find(sequences.begin(), sequences.end(), reply.sequence) - sequences.begin();
+				if (part == partition.count || reply.requestId != queues[part].front().requestId) { // late reply of an abandoned search
+					continue;
+				}
+				if (reply.status != Status::Ok) {
+					throw PartitionUnavailableException(part, "has no map " + string(1, queues[part].front().mapName));
+				}
+				sequences[part] = -1;
+				waiting--;
+				auto request = std::move(queues[part].front());
+				queues[part].pop_front();
+				onReply(part, request, reply);
+			}
+		}
+	}
+
+	// all destinations within maxDistance with their distances, ascending by vertex
+	vector<std::pair<Node_t, Distance_t>> Search(const MapManager& manager, const RequestId_t& requestId, const char mapName, const Node_t& source, const Distance_t& maxDistance, int& rounds) {
+		const auto infinity = std::numeric_limits<Distance_t>::max();
+		vector<vector<std::pair<Node_t, Distance_t>>> inbox(partition.count);
+		vector<Distance_t> minPending(partition.count, infinity);
+		vector<std::deque<PartitionRequest>> queues(partition.count);
+		inbox[partition.Owner(source)].emplace_back(source, 0);
+		auto route = [&](const int part, const PartitionRequest& request, const PartitionReply& reply) {
+			if (reply.missing) { // the rows of other partitions are of vertices they found on edges, so only the source can be missing
+				throw VertexNotFoundException(source);
+			}
+			if (request.action == PartitionAction::Step) {
+				minPending[part] = reply.minPending;
+			}
+			for (const auto& row : reply.distances) {
+				inbox[partition.Owner(row.first)].push_back(row);
+			}
+			if (!reply.last) {
+				auto fetch = PartitionRequest(requestId, PartitionAction::Fetch, mapName, maxDistance);
+				fetch.page = request.page + 1;
+				queues[part].push_back(std::move(fetch));
+			}
+		};
+		for (rounds = 0;; rounds++) {
+			auto nearest = *std::min_element(minPending.begin(), minPending.end());
+			for (const auto& rows : inbox) {
+				for (const auto& row : rows) {
+					nearest = std::min(nearest, row.second);
+				}
+			}
+			if (nearest == infinity) {
+				break;
+			}
+			auto threshold = delta > 0 && nearest <= infinity - delta ? nearest + delta : infinity;
+			for (auto p = 0; p < partition.count; p++) {
+				if (inbox[p].empty() && minPending[p] > threshold) {
+					continue;
+				}
+				// distances in pages, the last of them with the step
+				for (size_t begin = 0; begin < inbox[p].size() || begin == 0; begin += PARTITION_PAGE_ROWS) {
+					auto end = std::min(inbox[p].size(), begin + PARTITION_PAGE_ROWS);
+					auto request = PartitionRequest(requestId, end == inbox[p].size() ? PartitionAction::Step : PartitionAction::Update, mapName, maxDistance);
+					request.threshold = threshold;
+					request.distances.assign(inbox[p].begin() + begin, inbox[p].begin() + end);
+					queues[p].push_back(std::move(request));
+				}
+				inbox[p].clear();
+			}
+			Exchange(manager, queues, route);
+		}
+
+		vector<std::pair<Node_t, Distance_t>> found;
+		for (auto p = 0; p < partition.count; p++) {
+			queues[p].push_back(PartitionRequest(requestId, PartitionAction::Collect, mapName, maxDistance));
+		}
+		Exchange(manager, queues, [&](const int part, const PartitionRequest& request, const PartitionReply& reply) {
+			found.insert(found.end(), reply.distances.begin(), reply.distances.end());
+			if (!reply.last) {
+				auto collect = PartitionRequest(requestId, PartitionAction::Collect, mapName, maxDistance);
+				collect.page = request.page + 1;
+				queues[part].push_back(std::move(collect));
+			}
+		});
+		std::sort(found.begin(), found.end());
+		return found;
+	}
+
+	void Close(const MapManager& manager, const RequestId_t& requestId) {
+		auto close = PartitionRequest(requestId, PartitionAction::Close, 0, 0);
+		for (auto p = 1; p < partition.count; p++) {
+			close.Encode(*sendHelpers[p]);
+		}
+		auto none = PartitionReply(close);
+		local.Handle(manager, close, none);
+	}
+
+public:
+	PartitionCoordinator(const Options& options) : partition(ParsePartition(options.Get("partition", "0/1"))), ports(PartitionPorts(options, partition)),
+		delta(options.GetInt("partition-delta", 0)), receiveHelper(OpenDatagramReceiver(options, ports[0])),
+		nextRequestId(WallClockMicroseconds()) { // differs from an earlier run, whose searches may still be open in the other partitions
+		for (auto p = 0; p < partition.count; p++) {
+			sendHelpers.push_back(p == 0 ? nullptr : receiveHelper->SendHelper(HOST, ports[p].c_str()));
+		}
+	}
+
+	// same result as MapManager::CalcShortestPath on the whole map, VertexNotFoundException as well when the source is not in it, which its owner partition tells;
+	// status Unavailable if a partition does not reply
+	AllShortestPath CalcShortestPath(const MapManager& manager, const ClientQuery& query) {
+		std::lock_guard<std::mutex> lock(mutex);
+		const auto& info = manager.Find(query.mapName).Info();
+		auto bound = MapManager::Bound(query, info);
+		auto requestId = nextRequestId++;
+		auto start = NowMicroseconds();
+		auto rounds = 0;
+		vector<std::pair<Node_t, Distance_t>> found;
+		try {
+			ArenaBinding heap(nullptr); // messages of many rounds, released as they are used
+			found = Search(manager, requestId, query.mapName, query.sourceNode, bound.maxDistance, rounds);
+		} catch (const PartitionUnavailableException& ex) {
+			cout << "The Server A cannot finish the search: " << ex.what() << "." << endl;
+			Close(manager, requestId);
+			return AllShortestPath(query.requestId, Status::Unavailable);
+		} catch (const VertexNotFoundException&) {
+			Close(manager, requestId);
+			throw;
+		}
+		Close(manager, requestId);
+		cout << "The Server A has searched map " << query.mapName << " across " << partition.count << " partitions in " << rounds << " rounds and " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+
+		found.erase(std::remove_if(found.begin(), found.end(), [&](const std::pair<Node_t, Distance_t>& row) {
+			return row.first == query.sourceNode || (query.destination != ALL_DESTINATIONS && row.first != query.destination);
+		}), found.end());
+		if (bound.k > 0 && found.size() > (size_t)bound.k) { // k nearest, ties by smaller vertex
+			std::sort(found.begin(), found.end(), [](const std::pair<Node_t, Distance_t>& a, const std::pair<Node_t, Distance_t>& b) {
+				return a.second != b.second ? a.second < b.second : a.first < b.first;
+			});
+			found.resize(bound.k);
+			std::sort(found.begin(), found.end());
+		}
+		auto result = AllShortestPath(info, query.sourceNode);
+		result.distances.assign(found.begin(), found.end());
+		return result;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const char QUERY_LOG_MAGIC[] = { 'E', 'Q', 'L', '1' }; // first bytes of a query log, the number is the record layout
+const int QUERY_LOG_FLUSH_MILLISECONDS = 100;
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+class QueryLogFormatException : public EE450Exception {
+public:
+	explicit QueryLogFormatException(const string& filename) : EE450Exception("\"" + filename + "\" is not a query log") {}
+};
+
+// bytes of records in memory, appended by encoding and consumed by decoding
+class RecordBuffer : public SocketHelper {
+private:
+	vector<char> bytes;
+	size_t readIndex = 0;
+
+protected:
+	virtual void Read(char* buffer, const int size) {
+		if (readIndex + size > bytes.size()) {
+			throw PayloadSizeMismatchException();
+		}
+		memcpy(buffer, bytes.data() + readIndex, size);
+		readIndex += size;
+	}
+
+	virtual void Write(const char* buffer, const int size) {
+		bytes.insert(bytes.end(), buffer, buffer + size);
+	}
+
+public:
+	virtual void Flush() {}
+
+	vector<char>& Bytes() {
+		return bytes;
+	}
+
+	bool Exhausted() const {
+		return readIndex == bytes.size();
+	}
+
+	virtual size_t Remaining() const {
+		return bytes.size() - readIndex;
+	}
+};
+
+// one query as main server received it, with how long it took to answer
+struct QueryLogRecord : public Serializable {
+	Timestamp_t arrival = 0; // wall clock
+	Timestamp_t latency = 0; // until answered or rejected
+	QueryKind kind = QueryKind::Single; // Single, Batch or Stream
+	Status status = Status::Ok;
+	char mapName = 0;
+	Node_t destination = ALL_DESTINATIONS;
+	FileSize_t fileSize = 0;
+	Distance_t maxDistance = -1;
+	Delay_t maxDelay = -1;
+	int k = 0;
+	FlatVector<Node_t> sources; // one unless a batch
+
+	MESSAGE_FIELDS(arrival, latency, kind, status, mapName, destination, fileSize, maxDistance, maxDelay, k, sources)
+
+	QueryLogRecord(const ClientQuery& query, const Status _status, const Timestamp_t& _latency) : arrival(WallClockMicroseconds() - _latency), latency(_latency), kind(query.kind), status(_status),
+		mapName(query.mapName), destination(query.destination), fileSize(query.fileSize), maxDistance(query.maxDistance), maxDelay(query.maxDelay), k(query.k) {
+		sources.push_back(query.sourceNode);
+	}
+
+	QueryLogRecord(const BatchQuery& query, const Status _status, const Timestamp_t& _latency) : arrival(WallClockMicroseconds() - _latency), latency(_latency), kind(query.kind), status(_status),
+		mapName(query.mapName), fileSize(query.fileSize), maxDistance(query.maxDistance), maxDelay(query.maxDelay), k(query.k), sources(query.sources.begin(), query.sources.end()) {}
+
+	QueryLogRecord(SocketHelper& socket) {
+		DecodeFields(socket, Fields());
+	}
+
+	virtual void Encode(SocketHelper& socket) const {
+		EncodeFields(socket, Fields());
+		socket.Flush();
+	}
+
+	// the query as the client sent it, without deadline
+	ClientQuery Query() const {
+		auto query = ClientQuery(mapName, sources.at(0), fileSize);
+		query.kind = kind;
+		query.destination = destination;
+		query.maxDistance = maxDistance;
+		query.maxDelay = maxDelay;
+		query.k = k;
+		return query;
+	}
+
+	BatchQuery Batch() const {
+		auto query = BatchQuery(mapName, fileSize);
+		query.maxDistance = maxDistance;
+		query.maxDelay = maxDelay;
+		query.k = k;
+		query.sources.assign(sources.begin(), sources.end());
+		return query;
+	}
+};
+
+static_assert(QueryLogRecord::FIXED_SIZE == 59, "QueryLogRecord layout changed, bump QUERY_LOG_MAGIC");
+
+// queries received by main server appended to a binary file given by --query-log; a query is encoded into memory by the thread answering it
+// and a writer thread appends what has been collected every 100 ms and when the process is stopped, so logging costs no system call on the way of a query
+class QueryLog {
+private:
+	std::ofstream file;
+	std::mutex mutex;
+	RecordBuffer pending; // guarded by mutex
+	std::mutex writeMutex;
+	RecordBuffer writing; // guarded by writeMutex
+
+	void Flush() {
+		std::lock_guard<std::mutex> writeLock(writeMutex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::swap(writing.Bytes(), pending.Bytes());
+		}
+		if (!writing.Bytes().empty()) {
+			file.write(writing.Bytes().data(), writing.Bytes().size());
+			file.flush();
+			writing.Bytes().clear();
+		}
+	}
+
+	void Run() {
+		while (true) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(QUERY_LOG_FLUSH_MILLISECONDS));
+			Flush();
+		}
+	}
+
+public:
+	// appends to an existing log; constructed before any other thread is started, see StopHooks
+	explicit QueryLog(const Options& options) {
+		if (!options.Has("query-log")) {
+			return;
+		}
+		auto filename = options.Get("query-log", "");
+		file.open(filename, std::ios::binary | std::ios::app);
+		if (!file) {
+			throw ArgumentException("Cannot write query log " + filename);
+		}
+		if (file.tellp() == 0) {
+			file.write(QUERY_LOG_MAGIC, sizeof(QUERY_LOG_MAGIC));
+			file.flush();
+		}
+		StopHooks::Instance().Add([this] { Flush(); });
+		std::thread(&QueryLog::Run, this).detach();
+		cout << "The AWS is logging queries into " << filename << "." << endl;
+	}
+
+	template <typename Query>
+	void Append(const Query& query, const Status status, const Timestamp_t& latency) {
+		if (!file.is_open()) {
+			return;
+		}
+		auto record = QueryLogRecord(query, status, latency);
+		std::lock_guard<std::mutex> lock(mutex);
+		record.Encode(pending);
+	}
+
+	// all records of a log in order, allocated on heap
+	static vector<QueryLogRecord> Read(const string& filename) {
+		ArenaBinding heap(nullptr);
+		auto file = std::ifstream(filename, std::ios::binary);
+		if (!file.is_open()) {
+			throw ArgumentException("Cannot read query log " + filename);
+		}
+		RecordBuffer buffer;
+		buffer.Bytes().assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		char magic[sizeof(QUERY_LOG_MAGIC)];
+		if (buffer.Bytes().size() < sizeof(magic)) {
+			throw QueryLogFormatException(filename);
+		}
+		buffer.ReadBlock(magic, sizeof(magic));
+		if (memcmp(magic, QUERY_LOG_MAGIC, sizeof(magic)) != 0) {
+			throw QueryLogFormatException(filename);
+		}
+		vector<QueryLogRecord> records;
+		while (!buffer.Exhausted()) {
+			try {
+				records.emplace_back(buffer);
+			} catch (const PayloadSizeMismatchException&) { // the last record of a main server stopped while writing
+				break;
+			}
+		}
+		return records;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <climits>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+
+#include "common.hpp"
+#include "lockFreeQueue.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const int SHM_RING_SLOTS = 256; // datagrams waiting for one receiver, power of 2
+const Timestamp_t SHM_SEND_TIMEOUT = 100000; // microseconds a sender waits for a free slot before dropping the datagram, as a full UDP receive buffer would
+const string SHM_NAME_PREFIX = "/ee450_";
+
+static_assert(ATOMIC_LONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "Atomics shared between processes must be lock-free");
+
+//===============================================//
+//                     Tool                      //
+//===============================================//
+
+// how server A, server B and main server reach each other, all of them must use the same
+enum class Transport {
+	Udp,
+	Shm, // ring buffers in POSIX shared memory, same host only
+};
+
+Transport ParseTransport(const string& name) {
+	if (name == "udp") {
+		return Transport::Udp;
+	} else if (name == "shm") {
+		return Transport::Shm;
+	}
+	throw ArgumentException("Unknown transport " + name + ", expected udp or shm");
+}
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+class SharedMemoryException : public SocketException {
+public:
+	SharedMemoryException(const string& name, const string& action) : SocketException("Cannot " + action + " shared memory " + name + ": " + strerror(errno)) {}
+};
+
+// datagrams to one port in POSIX shared memory, written by any process on this host and read by the owner of the port
+// each slot carries a sequence number telling whether it is free or filled, as in MpmcQueue; the reader sleeps on a futex when there is nothing to read
+class ShmRing {
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		int length;
+		char data[BUFFER_SIZE];
+	};
+
+	struct Layout {
+		std::atomic<size_t> enqueuePosition;
+		char padding0[CACHE_LINE_SIZE]; // keep writers and the reader on different cache lines
+		size_t dequeuePosition; // single reader
+		std::atomic<uint32_t> signal; // bumped after every push, the futex word
+		std::atomic<uint32_t> sleeping; // reader waits on signal
+		char padding1[CACHE_LINE_SIZE];
+		Slot slots[SHM_RING_SLOTS];
+	};
+
+	string name;
+	Layout* layout = nullptr;
+
+	// the word is shared between processes, so no FUTEX_PRIVATE_FLAG
+	static long Futex(std::atomic<uint32_t>& word, const int op, const uint32_t value, const timespec* timeout) {
+		return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, value, timeout, nullptr, 0);
+	}
+
+	bool TryPush(const char* data, const int length) {
+		const auto mask = size_t(SHM_RING_SLOTS - 1);
+		auto position = layout->enqueuePosition.load(std::memory_order_relaxed);
+		while (true) {
+			auto& slot = layout->slots[position & mask];
+			auto sequence = slot.sequence.load(std::memory_order_acquire);
+			auto diff = (long long)sequence - (long long)position;
+			if (diff == 0) { // slot free, try to claim it
+				if (layout->enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					memcpy(slot.data, data, length);
+					slot.length = length;
+					slot.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) { // full
+				return false;
+			} else { // claimed by another writer
+				position = layout->enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool Readable() const {
+		const auto position = layout->dequeuePosition;
+		return layout->slots[position & (SHM_RING_SLOTS - 1)].sequence.load(std::memory_order_acquire) == position + 1;
+	}
+
+public:
+	// the owner creates the ring, or takes over the one left by its previous run; others open an existing one
+	ShmRing(const string& port, const bool owner) : name(SHM_NAME_PREFIX + port) {
+		auto fd = shm_open(name.c_str(), owner ? O_RDWR | O_CREAT : O_RDWR, 0600);
+		if (fd < 0) {
+			throw SharedMemoryException(name, "open");
+		}
+		struct stat status = {};
+		if ((owner && ftruncate(fd, sizeof(Layout)) != 0) || fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(Layout)) {
+			close(fd);
+			throw SharedMemoryException(name, "size");
+		}
+		auto address = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (address == MAP_FAILED) {
+			throw SharedMemoryException(name, "map");
+		}
+		layout = (Layout*)address;
+		if (owner) {
+			new (&layout->enqueuePosition) std::atomic<size_t>(0);
+			layout->dequeuePosition = 0;
+			new (&layout->signal) std::atomic<uint32_t>(0);
+			new (&layout->sleeping) std::atomic<uint32_t>(0);
+			for (size_t i = 0; i < SHM_RING_SLOTS; i++) {
+				new (&layout->slots[i].sequence) std::atomic<size_t>(i);
+			}
+		}
+	}
+
+	ShmRing(const ShmRing&) = delete;
+	ShmRing& operator=(const ShmRing&) = delete;
+
+	~ShmRing() {
+		munmap(layout, sizeof(Layout));
+	}
+
+	// ring of a remote port, mapped once per process; null while its owner has not started, and a datagram to it is lost as over UDP
+	static std::shared_ptr<ShmRing> Remote(const string& port) {
+		static std::mutex mutex;
+		static map<string, std::shared_ptr<ShmRing>> rings;
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = rings.find(port);
+		if (it != rings.end()) {
+			return it->second;
+		}
+		try {
+			auto ring = std::make_shared<ShmRing>(port, false);
+			rings[port] = ring;
+			return ring;
+		} catch (const SharedMemoryException&) {
+			return nullptr;
+		}
+	}
+
+	// false if no slot was freed within SHM_SEND_TIMEOUT
+	bool Push(const char* data, const int length) {
+		if (!SpinUntil(NowMicroseconds() + SHM_SEND_TIMEOUT, [&] { return TryPush(data, length); })) {
+			return false;
+		}
+		layout->signal.fetch_add(1);
+		if (layout->sleeping.load() != 0) {
+			Futex(layout->signal, FUTEX_WAKE, INT_MAX, nullptr);
+		}
+		return true;
+	}
+
+	// replace the content of buffer with the next datagram, false if there is none; owner only
+	bool TryPop(PooledBuffer& buffer) {
+		if (!Readable()) {
+			return false;
+		}
+		const auto position = layout->dequeuePosition;
+		auto& slot = layout->slots[position & (SHM_RING_SLOTS - 1)];
+		buffer.Clear();
+		buffer.Append(slot.data, slot.length);
+		slot.sequence.store(position + SHM_RING_SLOTS, std::memory_order_release);
+		layout->dequeuePosition = position + 1;
+		return true;
+	}
+
+	// wait until a datagram can be popped, negative timeout waits forever; owner only
+	bool Wait(const int timeoutMilliseconds) {
+		auto until = timeoutMilliseconds < 0 ? -1 : NowMicroseconds() + timeoutMilliseconds * 1000LL;
+		while (!Readable()) {
+			// announce sleeping before the last check, so a push after the check either wakes us or changes signal
+			auto seen = layout->signal.load();
+			layout->sleeping.store(1);
+			if (Readable()) {
+				break;
+			}
+			timespec timeout = {};
+			if (until >= 0) {
+				auto remaining = until - NowMicroseconds();
+				if (remaining <= 0) {
+					layout->sleeping.store(0);
+					return false;
+				}
+				timeout.tv_sec = remaining / 1000000;
+				timeout.tv_nsec = remaining % 1000000 * 1000;
+			}
+			Futex(layout->signal, FUTEX_WAIT, seen, until < 0 ? nullptr : &timeout);
+		}
+		layout->sleeping.store(0);
+		return true;
+	}
+};
+
+// datagram to the ring of a remote port, the host is always this one
+class ShmSendSocketHelper : public SocketHelper {
+private:
+	PooledBuffer buffer;
+	std::shared_ptr<ShmRing> ring;
+
+public:
+	explicit ShmSendSocketHelper(const std::shared_ptr<ShmRing>& _ring) : ring(_ring) {}
+
+	virtual void Read(char* buffer, const int size) {
+		throw UnsupportedOperationException();
+	}
+
+	virtual void Write(const char* buffer, const int size) {
+		if (this->buffer.Length() + size > BUFFER_SIZE) {
+			throw TooLargePayloadException();
+		}
+		this->buffer.Append(buffer, size);
+	}
+
+	virtual void Flush() {
+		if (ring) {
+			ring->Push(buffer.Data(), buffer.Length());
+		}
+		buffer.Clear();
+	}
+};
+
+// owner of the ring of a port, drop-in for UdpReceiveSocketHelper
+class ShmReceiveSocketHelper : public DatagramReceiveHelper {
+private:
+	ShmRing ring;
+	PooledBuffer buffer; // sized to the datagram taken from the ring
+	int readIndex = 0;
+
+	void PeekDatagram(char* buffer, const int size) {
+		if (readIndex == this->buffer.Length()) { // buffered data run out, take the next datagram
+			ring.Wait(-1);
+			ring.TryPop(this->buffer);
+			readIndex = 0;
+		}
+		if (readIndex + size > this->buffer.Length()) {
+			throw PayloadSizeMismatchException();
+		}
+		memcpy(buffer, this->buffer.Data() + readIndex, size);
+	}
+
+public:
+	explicit ShmReceiveSocketHelper(const string& _selfPort) : ring(_selfPort, true) {}
+
+	virtual std::unique_ptr<SocketHelper> SendHelper(const char* _remoteHost, const char* _remotePort) {
+		return std::unique_ptr<SocketHelper>(new ShmSendSocketHelper(ShmRing::Remote(_remotePort)));
+	}
+
+	virtual bool Wait(const int timeoutMilliseconds) {
+		return readIndex < buffer.Length() || ring.Wait(timeoutMilliseconds);
+	}
+
+	virtual void Discard() {
+		readIndex = buffer.Length();
+	}
+
+	virtual void Read(char* buffer, const int size) {
+		PeekDatagram(buffer, size);
+		readIndex += size;
+	}
+
+	// a message is one datagram
+	virtual size_t Remaining() const {
+		return buffer.Length() - readIndex;
+	}
+
+	virtual void Peek(char* buffer, const int size) {
+		PeekDatagram(buffer, size);
+	}
+	using SocketHelper::Peek;
+
+	virtual void Write(const char* buffer, const int size) {
+		throw UnsupportedOperationException();
+	}
+
+	virtual void Flush() {
+		throw UnsupportedOperationException();
+	}
+};
+
+// receiving end of a port over the transport chosen by --transport
+std::unique_ptr<DatagramReceiveHelper> OpenDatagramReceiver(const Options& options, const string& port) {
+	if (ParseTransport(options.Get("transport", "udp")) == Transport::Shm) {
+		return std::unique_ptr<DatagramReceiveHelper>(new ShmReceiveSocketHelper(port));
+	}
+	return std::unique_ptr<DatagramReceiveHelper>(new UdpReceiveSocketHelper(port.c_str()));
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// fixed set of threads running the indices of a loop in parallel, one loop at a time
+class ThreadPool {
+private:
+	vector<std::thread> threads;
+	std::mutex runMutex; // one loop at a time
+	std::mutex mutex;
+	std::condition_variable started;
+	std::condition_variable finished;
+	const std::function<void(size_t, size_t)>* task = nullptr;
+	size_t count = 0;
+	std::atomic<size_t> next;
+	size_t generation = 0; // number of loops started, wakes up workers
+	size_t running = 0; // workers still in current loop
+	std::exception_ptr error;
+	bool stopping = false;
+
+	void Work(const size_t worker) {
+		auto seen = size_t(0);
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				started.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping) {
+					return;
+				}
+				seen = generation;
+			}
+			for (auto index = next++; index < count; index = next++) {
+				try {
+					(*task)(index, worker);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				running--;
+			}
+			finished.notify_one();
+		}
+	}
+
+public:
+	explicit ThreadPool(const size_t size) : next(0) {
+		if (size == 0) {
+			throw ArgumentException("Thread pool needs at least 1 thread");
+		}
+		for (size_t i = 0; i < size; i++) {
+			threads.emplace_back(&ThreadPool::Work, this, i);
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		started.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	size_t Size() const {
+		return threads.size();
+	}
+
+	// run task(index, worker) for every index in [0, count), return when all are done; worker in [0, Size()) tells which thread runs it
+	// the first exception thrown by a task is rethrown here after the loop
+	void ParallelFor(const size_t count, const std::function<void(size_t, size_t)>& task) {
+		std::lock_guard<std::mutex> run(runMutex);
+		std::exception_ptr error;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			this->task = &task;
+			this->count = count;
+			next = 0;
+			running = threads.size();
+			this->error = nullptr;
+			generation++;
+			started.notify_all();
+			finished.wait(lock, [this] { return running == 0; });
+			this->task = nullptr;
+			error = this->error;
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+};
\ No newline at end of file
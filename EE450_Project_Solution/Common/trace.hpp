@@ -0,0 +1,223 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <fstream>
+#include <cstdlib>
+
+#include <sys/syscall.h>
+
+#include "common.hpp"
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const double DEFAULT_TRACE_SAMPLE = 0.01; // share of queries traced by main server
+const size_t TRACE_BUFFER_SPANS = 4096; // spans waiting for the flusher per thread, power of 2, more are dropped
+const int TRACE_FLUSH_MILLISECONDS = 200;
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// one timed step of a traced query, times are wall clock so that spans of all processes line up
+struct TraceSpan {
+	RequestId_t traceId;
+	const char* name; // string literal, only the pointer is kept
+	Timestamp_t start;
+	Timestamp_t end;
+	int tid;
+};
+
+// spans of a traced query recorded by any thread of this process, written to <prefix>.<process>.<pid>.trace by a flusher thread
+// each thread records into its own ring without locking, the flusher is the only reader; a query is traced when main server samples it,
+// its trace ID then travels in every request, and the other processes record spans of it when they are started with --trace
+class Tracer {
+private:
+	// ring of one thread at a time, handed to a new thread when its owner exits
+	struct SpanBuffer {
+		TraceSpan spans[TRACE_BUFFER_SPANS];
+		std::atomic<size_t> written; // by owner
+		std::atomic<size_t> read; // by flusher
+		std::atomic<size_t> dropped;
+		std::atomic<bool> owned;
+
+		SpanBuffer() : written(0), read(0), dropped(0), owned(true) {}
+	};
+
+	// gives the buffer of this thread back on thread exit
+	struct Lease {
+		SpanBuffer* buffer = nullptr;
+
+		~Lease() {
+			if (buffer != nullptr) {
+				buffer->owned.store(false, std::memory_order_release);
+			}
+		}
+	};
+
+	bool enabled = false;
+	double sampleRate = 0;
+	std::mutex mutex; // guards buffers and file
+	vector<std::unique_ptr<SpanBuffer>> buffers;
+	std::ofstream file;
+	size_t droppedReported = 0;
+
+	Tracer() {}
+
+	SpanBuffer& ThreadBuffer() {
+		static thread_local Lease lease;
+		if (lease.buffer == nullptr) {
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const auto& buffer : buffers) {
+				auto owned = false;
+				if (buffer->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+					lease.buffer = buffer.get();
+					break;
+				}
+			}
+			if (lease.buffer == nullptr) {
+				buffers.emplace_back(new SpanBuffer());
+				lease.buffer = buffers.back().get();
+			}
+		}
+		return *lease.buffer;
+	}
+
+	static int ThreadId() {
+		static thread_local int tid = (int)syscall(SYS_gettid);
+		return tid;
+	}
+
+	void Run() {
+		while (true) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(TRACE_FLUSH_MILLISECONDS));
+			Flush();
+		}
+	}
+
+public:
+	// never destroyed, threads may still record while the process exits
+	static Tracer& Instance() {
+		static auto instance = new Tracer();
+		return *instance;
+	}
+
+	// must be called before any other thread is started, see StopHooks
+	void Configure(const Options& options, const string& process) {
+		if (!options.Has("trace")) {
+			return;
+		}
+		sampleRate = options.GetDouble("trace-sample", DEFAULT_TRACE_SAMPLE);
+		if (sampleRate < 0 || sampleRate > 1) {
+			throw ArgumentException("Trace sample should be within [0, 1]");
+		}
+		auto path = options.Get("trace", "trace") + "." + process + "." + std::to_string(getpid()) + ".trace";
+		file.open(path);
+		if (!file) {
+			throw ArgumentException("Cannot write trace file " + path);
+		}
+		file << "# process " << process << " " << getpid() << "\n";
+		enabled = true;
+		StopHooks::Instance().Add([this] { Flush(); });
+		std::thread(&Tracer::Run, this).detach();
+		std::atexit([] { Instance().Flush(); });
+		cout << "The " << process << " is tracing into " << path << "." << endl;
+	}
+
+	bool Enabled() const {
+		return enabled;
+	}
+
+	// trace ID of a new query, 0 if it is not sampled
+	RequestId_t Sample() {
+		if (!enabled || sampleRate == 0) {
+			return 0;
+		}
+		static thread_local std::mt19937_64 random(std::random_device{}() ^ (RequestId_t)ThreadId() << 32);
+		if (std::uniform_real_distribution<double>(0, 1)(random) >= sampleRate) {
+			return 0;
+		}
+		auto id = RequestId_t(0);
+		while (id == 0) {
+			id = random();
+		}
+		return id;
+	}
+
+	// dropped when the flusher has fallen a whole ring behind
+	void Record(const RequestId_t& traceId, const char* name, const Timestamp_t& start, const Timestamp_t& end) {
+		if (traceId == 0 || !enabled) {
+			return;
+		}
+		auto& buffer = ThreadBuffer();
+		auto position = buffer.written.load(std::memory_order_relaxed);
+		if (position - buffer.read.load(std::memory_order_acquire) >= TRACE_BUFFER_SPANS) {
+			buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		auto& span = buffer.spans[position & (TRACE_BUFFER_SPANS - 1)];
+		span.traceId = traceId;
+		span.name = name;
+		span.start = start;
+		span.end = end;
+		span.tid = ThreadId();
+		buffer.written.store(position + 1, std::memory_order_release);
+	}
+
+	// one line per span: trace ID in hex, thread, start, end, name
+	void Flush() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!enabled) {
+			return;
+		}
+		auto dropped = size_t(0);
+		for (const auto& buffer : buffers) {
+			auto position = buffer->read.load(std::memory_order_relaxed);
+			auto end = buffer->written.load(std::memory_order_acquire);
+			for (; position != end; position++) {
+				const auto& span = buffer->spans[position & (TRACE_BUFFER_SPANS - 1)];
+				file << std::hex << span.traceId << std::dec << " " << span.tid << " " << span.start << " " << span.end << " " << span.name << "\n";
+			}
+			buffer->read.store(end, std::memory_order_release);
+			dropped += buffer->dropped.load(std::memory_order_relaxed);
+		}
+		if (dropped != droppedReported) {
+			file << "# dropped " << dropped - droppedReported << "\n";
+			droppedReported = dropped;
+		}
+		file.flush();
+	}
+};
+
+// span from when query was sent to now, the time it spent in transport and socket queues
+template <typename Query>
+void TraceQueued(const Query& query, const char* name) {
+	if (query.traceId != 0) {
+		Tracer::Instance().Record(query.traceId, name, query.sentAt, WallClockMicroseconds());
+	}
+}
+
+// span of the enclosing scope, recorded when it ends; costs one branch when the query is not traced
+class TraceScope {
+private:
+	RequestId_t traceId;
+	const char* name;
+	Timestamp_t start;
+
+public:
+	TraceScope(const RequestId_t& _traceId, const char* _name) : traceId(Tracer::Instance().Enabled() ? _traceId : 0), name(_name), start(traceId != 0 ? WallClockMicroseconds() : 0) {}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	~TraceScope() {
+		if (traceId != 0) {
+			Tracer::Instance().Record(traceId, name, start, WallClockMicroseconds());
+		}
+	}
+};
\ No newline at end of file
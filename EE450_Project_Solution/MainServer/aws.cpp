@@ -1,11 +1,26 @@
 #include <iostream>
 #include <memory>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
 
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 
 #include "common.hpp"
+#include "sharedMemory.hpp"
+#include "trace.hpp"
+#include "queryLog.hpp"
+#ifdef FUSED
+#include "lockFreeQueue.hpp"
+#include "mapEngine.hpp"
+#include "delayEngine.hpp"
+#endif
 
 using std::cout;
 using std::endl;
@@ -18,59 +33,1146 @@ using std::endl;
 //                    Const                      //
 //===============================================//
 
+const int LATENCY_WINDOW_SIZE = 256;
+const int HEDGE_MIN_SAMPLES = 16; // use initial hedge delay until enough samples collected
+const double DEFAULT_HEDGE_PERCENTILE = 95;
+const int DEFAULT_HEDGE_INITIAL_MILLISECONDS = 10;
+const int FUSED_QUEUE_CAPACITY = 1024;
+const int DEFAULT_BATCH_CHUNK = 64; // sources per request to server A
+const int DEFAULT_BATCH_INFLIGHT_KILOBYTES = 128; // kept below the default socket receive buffer, so that a burst of datagrams is not dropped
+const int STREAM_CHUNK_TIMEOUT_MILLISECONDS = 5000; // a chunk of a stream not arriving within this is taken as lost
+const int DEFAULT_REPLY_TIMEOUT_MILLISECONDS = 5000;
+
 //===============================================//
 //                     Tool                      //
 //===============================================//
 
+// earlier of two monotonic time points, negative means never
+Timestamp_t Earlier(const Timestamp_t& a, const Timestamp_t& b) {
+	if (a < 0) {
+		return b;
+	}
+	if (b < 0) {
+		return a;
+	}
+	return std::min(a, b);
+}
+
+// bind the calling thread to one core, threads it starts afterwards inherit the binding
+void PinToCore(const int core) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
 //===============================================//
 //                    Class                      //
 //===============================================//
 
+// query cannot be answered, the client is told the reason instead
+class QueryFailedException : public EE450Exception {
+public:
+	const Status status;
+
+	explicit QueryFailedException(const Status _status) : EE450Exception("Query failed: " + StatusText(_status)), status(_status) {}
+};
+
+// most recent latency samples of one kind of request
+class LatencyWindow {
+private:
+	vector<Timestamp_t> samples;
+	size_t next = 0;
+	mutable std::mutex mutex;
+
+public:
+	void Add(const Timestamp_t& latency) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (samples.size() < LATENCY_WINDOW_SIZE) {
+			samples.push_back(latency);
+		} else {
+			samples[next] = latency;
+			next = (next + 1) % LATENCY_WINDOW_SIZE;
+		}
+	}
+
+	size_t Count() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return samples.size();
+	}
+
+	// percentile in [0, 100]
+	Timestamp_t Percentile(const double percentile) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (samples.empty()) {
+			return 0;
+		}
+		auto sorted = samples;
+		auto index = std::min(sorted.size() - 1, (size_t)(percentile / 100 * sorted.size()));
+		std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+		return sorted[index];
+	}
+};
+
+// replicas of one backend role, a duplicate request is sent to another replica when the first one is slow
+class ReplicaSet {
+private:
+	string role;
+	vector<string> ports;
+	std::atomic<size_t> next;
+	LatencyWindow latency;
+	double hedgePercentile;
+	Timestamp_t initialHedgeDelay;
+
+public:
+	std::atomic<long long> requestCount;
+	std::atomic<long long> hedgeCount;
+	std::atomic<long long> hedgeWinCount;
+
+	ReplicaSet(const string& _role, const vector<string>& _ports, const double _hedgePercentile, const Timestamp_t& _initialHedgeDelay) : role(_role), ports(_ports), next(0), hedgePercentile(_hedgePercentile), initialHedgeDelay(_initialHedgeDelay), requestCount(0), hedgeCount(0), hedgeWinCount(0) {
+		if (ports.empty()) {
+			throw ArgumentException("No replica for " + role);
+		}
+	}
+
+	const string& Role() const {
+		return role;
+	}
+
+	bool Hedging() const {
+		return ports.size() > 1;
+	}
+
+	// replica for a new request, in round robin
+	size_t Pick() {
+		return next++ % ports.size();
+	}
+
+	size_t Alternate(const size_t replica) const {
+		return (replica + 1) % ports.size();
+	}
+
+	const char* Port(const size_t replica) const {
+		return ports[replica].c_str();
+	}
+
+	// how long to wait for the first replica before hedging
+	Timestamp_t HedgeDelay() const {
+		return latency.Count() < HEDGE_MIN_SAMPLES ? initialHedgeDelay : latency.Percentile(hedgePercentile);
+	}
+
+	// elapsed is the latency of the first replica, or a lower bound of it when the hedge won; slow requests must stay in the window,
+	// else it holds only what was faster than the hedge delay and the delay keeps falling
+	void Record(const Timestamp_t& elapsed, const bool hedged, const bool hedgeWon) {
+		latency.Add(elapsed);
+		requestCount++;
+		hedgeCount += hedged;
+		hedgeWinCount += hedgeWon;
+	}
+
+	void PrintStatistics() const {
+		cout << "The AWS has hedged " << hedgeCount << " of " << requestCount << " requests to " << role << " (" << hedgeWinCount << " won by the hedge, hedge delay " << HedgeDelay() / 1000.0 << " ms)." << endl;
+	}
+};
+
+// receives all backend replies on the AWS UDP port, and hands each one to the thread waiting for its request ID
+class ReplyDispatcher {
+private:
+	DatagramReceiveHelper& socket;
+	std::mutex mutex;
+	std::condition_variable arrived;
+	map<RequestId_t, std::function<void(SocketHelper&)>> decoders;
+
+public:
+	ReplyDispatcher(DatagramReceiveHelper& _socket) : socket(_socket) {}
+
+	// receiving loop, runs in its own thread
+	void Run() {
+		while (true) {
+			try {
+				socket.Wait(-1);
+				auto id = socket.Peek<RequestId_t>();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					auto it = decoders.find(id);
+					if (it != decoders.end()) {
+						it->second(socket);
+					}
+				}
+				socket.Discard(); // nobody waits for it, or the rest of a decoded datagram
+				arrived.notify_all();
+			} catch (const std::exception& ex) {
+				socket.Discard();
+				std::cerr << ex.what() << endl;
+			}
+		}
+	}
+
+	// decode the reply of request ID with decoder when it arrives
+	void Expect(const RequestId_t& id, const std::function<void(SocketHelper&)>& decoder) {
+		std::lock_guard<std::mutex> lock(mutex);
+		decoders[id] = decoder;
+	}
+
+	void Forget(const RequestId_t& id) {
+		std::lock_guard<std::mutex> lock(mutex);
+		decoders.erase(id);
+	}
+
+	// wait until ready returns true, or until monotonic time point, negative waits forever
+	template <typename Predicate>
+	bool WaitUntil(const Timestamp_t& until, const Predicate& ready) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (until < 0) {
+			arrived.wait(lock, ready);
+			return true;
+		}
+		return arrived.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::microseconds(until)), ready);
+	}
+};
+
+// identical in-flight queries to server A share a single request, the first query is the leader
+class SingleFlight {
+private:
+	// what server A answers depends on; the file size only matters through a delay bound
+	typedef std::tuple<char, Node_t, Node_t, Distance_t, Delay_t, FileSize_t, int> Key;
+
+	struct Flight {
+		bool done = false;
+		std::shared_ptr<const AllShortestPath> result;
+		std::exception_ptr error;
+	};
+
+	std::mutex mutex;
+	std::condition_variable landed;
+	map<Key, std::shared_ptr<Flight>> flights;
+
+public:
+	std::atomic<long long> queryCount;
+	std::atomic<long long> requestCount;
+
+	SingleFlight() : queryCount(0), requestCount(0) {}
+
+	// result of fetch for the key of query, fetch is only called by the leader; joined is set when sharing another query's request
+	// only an Ok result is shared: the failure of a leader may come from its own deadline, so a joiner whose deadline has not passed
+	// tries again, and the first of them to do so leads the next request
+	template <typename Fetch>
+	std::shared_ptr<const AllShortestPath> Get(const ClientQuery& query, const Timestamp_t& deadline, bool& joined, const Fetch& fetch) {
+		auto key = Key(query.mapName, query.sourceNode, query.destination, query.maxDistance, query.maxDelay, query.maxDelay >= 0 ? query.fileSize : 0, query.k);
+		std::shared_ptr<Flight> flight;
+		queryCount++;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (true) {
+				auto it = flights.find(key);
+				joined = it != flights.end();
+				if (!joined) {
+					break;
+				}
+				flight = it->second;
+				auto ready = [&flight] { return flight->done; };
+				if (deadline < 0) {
+					landed.wait(lock, ready);
+				} else if (!landed.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::microseconds(deadline)), ready)) {
+					throw QueryFailedException(Status::DeadlineExceeded);
+				}
+				if (!flight->error) {
+					return flight->result;
+				}
+				if (deadline >= 0 && NowMicroseconds() >= deadline) {
+					throw QueryFailedException(Status::DeadlineExceeded);
+				}
+			}
+			flight = std::make_shared<Flight>();
+			flights[key] = flight;
+		}
+		requestCount++;
+		std::shared_ptr<const AllShortestPath> result;
+		std::exception_ptr error;
+		try {
+			ArenaBinding heap(nullptr); // result is shared with threads outliving this request, so it stays on heap
+			result = std::make_shared<const AllShortestPath>(fetch());
+		} catch (...) {
+			error = std::current_exception();
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			flight->done = true;
+			flight->result = result;
+			flight->error = error;
+			flights.erase(key);
+		}
+		landed.notify_all();
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		return result;
+	}
+
+	// queries per request sent to server A
+	double Ratio() const {
+		return requestCount == 0 ? 1 : (double)queryCount / requestCount;
+	}
+};
+
+// where the logic of server A and server B runs
+class Backend {
+public:
+	virtual ~Backend() {}
+
+	virtual AllShortestPath ShortestPath(const ClientQuery& query, const Timestamp_t& deadline) = 0;
+
+	// shortestPath is shared, a backend may keep it past its return
+	virtual AllDelay Delay(const ClientQuery& query, const std::shared_ptr<const AllShortestPath>& shortestPath, const Timestamp_t& deadline) = 0;
+
+	// results of all sources of a batch in source order, the batch fails as a whole
+	virtual vector<std::shared_ptr<const AllShortestPath>> ShortestPaths(const BatchQuery& query, const Timestamp_t& deadline) = 0;
+
+	// shortestPaths are results of ShortestPaths of the same backend
+	virtual vector<AllDelay> Delays(const BatchQuery& query, const vector<std::shared_ptr<const AllShortestPath>>& shortestPaths, const Timestamp_t& deadline) = 0;
+
+	// results of a query a chunk at a time, each handed to forward(shortestPath, delay, last) before the next chunk is calculated
+	virtual void Stream(const ClientQuery& query, const Timestamp_t& deadline, const std::function<void(const AllShortestPath&, const AllDelay&, bool)>& forward) = 0;
+
+	virtual bool Hedging() const {
+		return false;
+	}
+
+	virtual void PrintStatistics() const {}
+};
+
+// server A and server B processes reached over UDP, or over shared memory with --transport=shm
+// each reactor of main server has its own backend, receiving replies on its own port
+class UdpBackend : public Backend {
+private:
+	const char* udpPort; // SERVER_AWS_UDP_PORT plus the reactor
+	std::unique_ptr<DatagramReceiveHelper> receiveHelper;
+	ReplyDispatcher dispatcher;
+	ReplicaSet serverA;
+	ReplicaSet serverB;
+	std::atomic<RequestId_t> nextRequestId; // 0 means no request
+	size_t batchChunk;
+	size_t batchInflight; // bytes of requests or replies of a batch on the way at a time
+	Timestamp_t replyTimeout; // a request without reply for this long fails, even without deadline, since a datagram may be lost
+
+	// failure of a request given up waiting: its deadline has passed, else its reply was lost or its server is down
+	static QueryFailedException GiveUp(const Timestamp_t& deadline) {
+		return QueryFailedException(deadline >= 0 && NowMicroseconds() >= deadline ? Status::DeadlineExceeded : Status::Unavailable);
+	}
+
+	// send a request to one replica, hedge to another replica if no reply within hedge delay or if the first one rejects it; the first Ok reply wins,
+	// a rejection is taken only once no other reply is outstanding
+	template <typename Reply, typename Sender>
+	Reply Call(ReplicaSet& replicas, const Timestamp_t& deadline, const Sender& send) {
+		struct Attempt {
+			RequestId_t id = 0; // 0 while not sent
+			typename std::aligned_storage<sizeof(Reply), alignof(Reply)>::type storage; // reply is decoded in place by dispatcher thread
+			Reply* reply = nullptr;
+			Timestamp_t elapsed = 0; // from start until reply
+		};
+		auto start = NowMicroseconds();
+		Attempt attempts[2]; // first replica, then the hedge
+		auto arena = CurrentArena();
+		auto expect = [&](Attempt& attempt, const RequestId_t& id) {
+			attempt.id = id;
+			dispatcher.Expect(id, [&attempt, arena, start](SocketHelper& socket) {
+				if (attempt.reply == nullptr) {
+					ArenaBinding binding(arena); // into the arena of requesting thread
+					attempt.reply = new (&attempt.storage) Reply(socket);
+					attempt.elapsed = NowMicroseconds() - start;
+				}
+			});
+		};
+		auto settled = [&attempts] { // an Ok reply, or a reply to every request sent
+			auto all = true;
+			for (const auto& attempt : attempts) {
+				if (attempt.reply != nullptr && attempt.reply->status == Status::Ok) {
+					return true;
+				}
+				all = all && (attempt.id == 0 || attempt.reply != nullptr);
+			}
+			return all;
+		};
+		auto forget = [&] { // decoders refer to local variables, must be removed before return
+			for (const auto& attempt : attempts) {
+				if (attempt.id != 0) {
+					dispatcher.Forget(attempt.id);
+				}
+			}
+		};
+		auto destroy = [&] {
+			for (auto& attempt : attempts) {
+				if (attempt.reply != nullptr) {
+					attempt.reply->~Reply();
+				}
+			}
+		};
+		auto sendTo = [&](const size_t to, const RequestId_t& id) {
+			ArenaBinding heap(nullptr); // the dispatcher may be decoding a reply into the arena of this thread meanwhile, and the arena has no lock
+			send(replicas.Port(to), id);
+		};
+		auto replica = replicas.Pick();
+		try {
+			expect(attempts[0], nextRequestId++);
+			sendTo(replica, attempts[0].id);
+			if (replicas.Hedging()) {
+				auto rejected = false;
+				auto replied = dispatcher.WaitUntil(Earlier(start + replicas.HedgeDelay(), deadline), [&] {
+					rejected = attempts[0].reply != nullptr && attempts[0].reply->status != Status::Ok;
+					return attempts[0].reply != nullptr;
+				});
+				if (!replied || rejected) {
+					if (deadline >= 0 && NowMicroseconds() >= deadline) {
+						throw QueryFailedException(Status::DeadlineExceeded);
+					}
+					expect(attempts[1], nextRequestId++);
+					sendTo(replicas.Alternate(replica), attempts[1].id);
+				}
+			}
+			if (!dispatcher.WaitUntil(Earlier(start + replyTimeout, deadline), settled)) {
+				throw GiveUp(deadline);
+			}
+		} catch (...) {
+			forget();
+			destroy();
+			throw;
+		}
+		forget();
+		auto taken = -1; // the earliest Ok reply, else a rejection
+		for (auto i = 0; i < 2; i++) {
+			if (attempts[i].reply != nullptr && attempts[i].reply->status == Status::Ok && (taken < 0 || attempts[i].elapsed < attempts[taken].elapsed)) {
+				taken = i;
+			}
+		}
+		if (taken < 0) {
+			taken = attempts[0].reply != nullptr ? 0 : 1;
+		}
+		auto status = attempts[taken].reply->status;
+		auto primaryLatency = attempts[0].reply != nullptr ? attempts[0].elapsed : NowMicroseconds() - start; // a lower bound when it never replied
+		replicas.Record(primaryLatency, attempts[1].id != 0, taken == 1 && status == Status::Ok);
+		if (status != Status::Ok) {
+			destroy();
+			throw QueryFailedException(status);
+		}
+		auto result = std::move(*attempts[taken].reply);
+		destroy();
+		return result;
+	}
+
+	// requests for count items, item i is replied under request ID first + i, send(port, id, begin, end) sends items [begin, end) in one request and returns its bytes
+	// items on the way are limited by the larger of request and reply bytes per item seen so far, requests are spread over replicas without hedging
+	template <typename Reply, typename Sender>
+	vector<Reply> Pipeline(ReplicaSet& replicas, const size_t count, const size_t chunk, const Timestamp_t& deadline, const Sender& send) {
+		vector<std::unique_ptr<Reply>> replies(count);
+		std::atomic<size_t> received(0);
+		std::atomic<size_t> itemSize(BUFFER_SIZE); // unknown until the first reply, assume the largest
+		std::atomic<bool> rejected(false);
+		auto arena = CurrentArena();
+		auto first = nextRequestId.fetch_add(count);
+		auto forget = [&] { // decoders refer to local variables, must be removed before return
+			for (size_t i = 0; i < count; i++) {
+				dispatcher.Forget(first + i);
+			}
+		};
+		auto requestSize = size_t(0); // per item, of requests sent so far
+		auto limit = [&] { // items on the way at a time
+			return std::max(size_t(1), batchInflight / std::max(itemSize.load(), requestSize));
+		};
+		auto wait = [&](const std::function<bool()>& ready) { // given up once no reply arrived for the reply timeout
+			while (true) {
+				auto seen = received.load();
+				if (dispatcher.WaitUntil(Earlier(NowMicroseconds() + replyTimeout, deadline), ready)) {
+					return;
+				}
+				if ((deadline >= 0 && NowMicroseconds() >= deadline) || received == seen) {
+					throw GiveUp(deadline);
+				}
+			}
+		};
+		try {
+			for (size_t i = 0; i < count; i++) {
+				dispatcher.Expect(first + i, [&replies, &received, &itemSize, &rejected, arena, i](SocketHelper& socket) {
+					if (!replies[i]) {
+						ArenaBinding binding(arena);
+						replies[i].reset(new Reply(socket));
+						if (received == 0) {
+							itemSize = replies[i]->EncodedSize();
+						} else {
+							itemSize = std::max(itemSize.load(), replies[i]->EncodedSize());
+						}
+						rejected = rejected || replies[i]->status != Status::Ok;
+						received++;
+					}
+				});
+			}
+			for (size_t sent = 0; sent < count;) {
+				auto end = sent;
+				wait([&] {
+					end = std::min(count, sent + std::min(chunk, limit()));
+					return rejected || sent == received || end - received <= limit();
+				});
+				if (rejected) {
+					break;
+				}
+				ArenaBinding heap(nullptr); // requests are built on heap, replies to earlier ones are being decoded into the arena of this thread
+				requestSize = std::max(requestSize, send(replicas.Port(replicas.Pick()), first + sent, sent, end) / (end - sent));
+				sent = end;
+			}
+			wait([&] { return rejected || received == count; });
+		} catch (...) {
+			forget();
+			throw;
+		}
+		forget();
+		vector<Reply> result;
+		result.reserve(count);
+		for (const auto& reply : replies) {
+			if (reply && reply->status != Status::Ok) {
+				throw QueryFailedException(reply->status);
+			}
+		}
+		for (auto& reply : replies) {
+			result.push_back(std::move(*reply));
+		}
+		return result;
+	}
+
+public:
+	UdpBackend(const Options& options, const int reactor) : udpPort(AwsReplyPort(RequestId_t(reactor) << REACTOR_REQUEST_SHIFT)), receiveHelper(OpenDatagramReceiver(options, udpPort)), dispatcher(*receiveHelper),
+		serverA("server A", options.GetList("server-a-ports", SERVER_A_PORT), options.GetDouble("hedge-percentile", DEFAULT_HEDGE_PERCENTILE), options.GetInt("hedge-initial-ms", DEFAULT_HEDGE_INITIAL_MILLISECONDS) * 1000),
+		serverB("server B", options.GetList("server-b-ports", SERVER_B_PORT), options.GetDouble("hedge-percentile", DEFAULT_HEDGE_PERCENTILE), options.GetInt("hedge-initial-ms", DEFAULT_HEDGE_INITIAL_MILLISECONDS) * 1000),
+		nextRequestId((RequestId_t(reactor) << REACTOR_REQUEST_SHIFT) + 1), batchChunk(options.GetInt("batch-chunk", DEFAULT_BATCH_CHUNK)), batchInflight(options.GetInt("batch-inflight-kb", DEFAULT_BATCH_INFLIGHT_KILOBYTES) * 1024),
+		replyTimeout(options.GetInt("reply-timeout-ms", DEFAULT_REPLY_TIMEOUT_MILLISECONDS) * 1000) {
+		if (batchChunk == 0 || batchInflight == 0) {
+			throw ArgumentException("Batch chunk and in-flight bytes should be positive");
+		}
+		if (replyTimeout <= 0) {
+			throw ArgumentException("Reply timeout should be positive");
+		}
+		std::thread(&ReplyDispatcher::Run, &dispatcher).detach();
+	}
+
+	// a result too large for one datagram is taken from a stream of server A instead
+	virtual AllShortestPath ShortestPath(const ClientQuery& query, const Timestamp_t& deadline) {
+		TraceScope span(query.traceId, "aws call server A");
+		try {
+			return Call<AllShortestPath>(serverA, deadline, [&](const char* port, const RequestId_t& id) {
+				auto sendA = receiveHelper->SendHelper(HOST, port);
+				auto request = query;
+				request.requestId = id;
+				request.Encode(*sendA);
+				cout << "The AWS has sent map ID and starting vertex to server A using UDP over port " << udpPort << "." << endl;
+			});
+		} catch (const QueryFailedException& ex) {
+			if (ex.status != Status::TooLarge) {
+				throw;
+			}
+		}
+		cout << "The AWS has asked server A to stream the shortest paths, they do not fit in one datagram." << endl;
+		auto result = AllShortestPath(MapInfo(), query.sourceNode);
+		StreamShortestPaths(query, deadline, [&](const ShortestPathChunk& chunk) {
+			result.mapInfo = chunk.mapInfo;
+			result.distances.insert(result.distances.end(), chunk.distances.begin(), chunk.distances.end());
+		});
+		std::sort(result.distances.begin(), result.distances.end()); // chunks come in the order of distance, a reply is in the order of destination
+		return result;
+	}
+
+	// shortest paths too many for one datagram go to server B in slices of a stream chunk each
+	virtual AllDelay Delay(const ClientQuery& query, const std::shared_ptr<const AllShortestPath>& shortestPath, const Timestamp_t& deadline) {
+		TraceScope span(query.traceId, "aws call server B");
+		if (query.EncodedSize() + shortestPath->EncodedSize() > BUFFER_SIZE) {
+			return DelayInSlices(query, *shortestPath, deadline);
+		}
+		return Call<AllDelay>(serverB, deadline, [&](const char* port, const RequestId_t& id) {
+			auto sendB = receiveHelper->SendHelper(HOST, port);
+			auto request = query;
+			request.requestId = id;
+			request.Encode(*sendB, *shortestPath);
+			cout << "The AWS has sent path length, propagation speed and transmission speed to server B using UDP over port " << udpPort << "." << endl;
+		});
+	}
+
+	// when a source has a result too large for one datagram, every source is asked for on its own, so that it can be streamed
+	virtual vector<std::shared_ptr<const AllShortestPath>> ShortestPaths(const BatchQuery& query, const Timestamp_t& deadline) {
+		vector<AllShortestPath> replies;
+		try {
+			replies = PipelineShortestPaths(query, deadline);
+		} catch (const QueryFailedException& ex) {
+			if (ex.status != Status::TooLarge) {
+				throw;
+			}
+			for (size_t i = 0; i < query.sources.size(); i++) {
+				replies.push_back(ShortestPath(query.Single(i), deadline));
+			}
+		}
+		vector<std::shared_ptr<const AllShortestPath>> result;
+		result.reserve(replies.size());
+		for (auto& reply : replies) {
+			result.push_back(std::make_shared<const AllShortestPath>(std::move(reply)));
+		}
+		return result;
+	}
+
+	// when the shortest paths of a source do not fit in one datagram, every source is sent on its own, so that they can go in slices
+	virtual vector<AllDelay> Delays(const BatchQuery& query, const vector<std::shared_ptr<const AllShortestPath>>& shortestPaths, const Timestamp_t& deadline) {
+		for (size_t i = 0; i < shortestPaths.size(); i++) {
+			if (query.Single(i).EncodedSize() + shortestPaths[i]->EncodedSize() > BUFFER_SIZE) {
+				vector<AllDelay> result;
+				for (size_t j = 0; j < shortestPaths.size(); j++) {
+					result.push_back(Delay(query.Single(j), shortestPaths[j], deadline));
+				}
+				return result;
+			}
+		}
+		return PipelineDelays(query, shortestPaths, deadline);
+	}
+
+	// a stream stays on one replica of server A, which keeps its search; the next window is requested when the first chunk of a window is taken, so at most two windows wait here
+	virtual void Stream(const ClientQuery& query, const Timestamp_t& deadline, const std::function<void(const AllShortestPath&, const AllDelay&, bool)>& forward) {
+		auto item = query;
+		item.kind = QueryKind::BatchItem; // server B need not print every chunk
+		StreamShortestPaths(query, deadline, [&](const ShortestPathChunk& chunk) {
+			auto shortestPath = AllShortestPath(chunk.mapInfo, query.sourceNode);
+			shortestPath.distances.assign(chunk.distances.begin(), chunk.distances.end());
+			TraceScope span(query.traceId, "aws stream chunk"); // delays of the chunk from server B, then forwarded
+			auto delay = Call<AllDelay>(serverB, deadline, [&](const char* port, const RequestId_t& id) {
+				auto sendB = receiveHelper->SendHelper(HOST, port);
+				auto request = item;
+				request.requestId = id;
+				request.Encode(*sendB, shortestPath);
+			});
+			forward(shortestPath, delay, chunk.last);
+		});
+	}
+
+	virtual bool Hedging() const {
+		return serverA.Hedging() || serverB.Hedging();
+	}
+
+	virtual void PrintStatistics() const {
+		serverA.PrintStatistics();
+		serverB.PrintStatistics();
+	}
+
+private:
+	vector<AllShortestPath> PipelineShortestPaths(const BatchQuery& query, const Timestamp_t& deadline) {
+		TraceScope span(query.traceId, "aws call server A");
+		auto replies = Pipeline<AllShortestPath>(serverA, query.sources.size(), batchChunk, deadline, [&](const char* port, const RequestId_t& id, const size_t begin, const size_t end) {
+			auto sendA = receiveHelper->SendHelper(HOST, port);
+			auto request = BatchQuery(query.mapName, query.fileSize);
+			request.requestId = id;
+			request.traceId = query.traceId;
+			request.deadline = query.deadline;
+			request.maxDistance = query.maxDistance;
+			request.maxDelay = query.maxDelay;
+			request.k = query.k;
+			request.sources.assign(query.sources.begin() + begin, query.sources.begin() + end);
+			request.Encode(*sendA);
+			return request.EncodedSize();
+		});
+		cout << "The AWS has sent map ID and " << query.sources.size() << " starting vertices to server A using UDP over port " << udpPort << "." << endl;
+		return replies;
+	}
+
+	vector<AllDelay> PipelineDelays(const BatchQuery& query, const vector<std::shared_ptr<const AllShortestPath>>& shortestPaths, const Timestamp_t& deadline) {
+		TraceScope span(query.traceId, "aws call server B");
+		auto result = Pipeline<AllDelay>(serverB, query.sources.size(), 1, deadline, [&](const char* port, const RequestId_t& id, const size_t begin, const size_t end) {
+			auto sendB = receiveHelper->SendHelper(HOST, port);
+			auto request = query.Single(begin);
+			request.requestId = id;
+			request.Encode(*sendB, *shortestPaths[begin]);
+			return request.EncodedSize() + shortestPaths[begin]->EncodedSize();
+		});
+		cout << "The AWS has sent path length, propagation speed and transmission speed of " << query.sources.size() << " starting vertices to server B using UDP over port " << udpPort << "." << endl;
+		return result;
+	}
+
+	// shortest paths of query from a stream of server A, each chunk handed to take in order
+	void StreamShortestPaths(const ClientQuery& query, const Timestamp_t& deadline, const std::function<void(const ShortestPathChunk&)>& take) {
+		map<int, std::unique_ptr<ShortestPathChunk>> chunks; // by sequence, guarded by the dispatcher
+		auto portA = serverA.Port(serverA.Pick());
+		auto streamId = nextRequestId++;
+		auto send = [&](const QueryKind kind) {
+			auto sendA = receiveHelper->SendHelper(HOST, portA);
+			auto request = query;
+			request.kind = kind;
+			request.requestId = streamId;
+			request.Encode(*sendA);
+		};
+		try {
+			dispatcher.Expect(streamId, [&chunks](SocketHelper& socket) {
+				ArenaBinding heap(nullptr); // this thread keeps allocating from its arena while chunks arrive
+				std::unique_ptr<ShortestPathChunk> chunk(new ShortestPathChunk(socket));
+				auto sequence = chunk->sequence;
+				chunks.emplace(sequence, std::move(chunk));
+			});
+			send(QueryKind::Stream);
+			cout << "The AWS has sent map ID and starting vertex of a stream to server A using UDP over port " << udpPort << "." << endl;
+			auto last = false;
+			for (auto sequence = 0; !last; sequence++) {
+				std::unique_ptr<ShortestPathChunk> chunk;
+				auto arrived = dispatcher.WaitUntil(Earlier(NowMicroseconds() + STREAM_CHUNK_TIMEOUT_MILLISECONDS * 1000, deadline), [&] {
+					auto it = chunks.find(sequence);
+					if (it == chunks.end()) {
+						return false;
+					}
+					chunk = std::move(it->second);
+					chunks.erase(it);
+					return true;
+				});
+				if (!arrived) { // lost, or the deadline of the query has passed
+					throw GiveUp(deadline);
+				}
+				if (chunk->status != Status::Ok) {
+					throw QueryFailedException(chunk->status);
+				}
+				last = chunk->last;
+				if (!last && sequence % STREAM_WINDOW_CHUNKS == 0) {
+					send(QueryKind::StreamNext);
+				}
+				take(*chunk);
+			}
+		} catch (...) {
+			dispatcher.Forget(streamId);
+			throw;
+		}
+		dispatcher.Forget(streamId);
+	}
+
+	// delays of shortest paths too many for one datagram, from server B a slice at a time
+	AllDelay DelayInSlices(const ClientQuery& query, const AllShortestPath& shortestPath, const Timestamp_t& deadline) {
+		auto item = query;
+		item.kind = QueryKind::BatchItem; // server B need not print every slice
+		auto rows = shortestPath.distances.size();
+		auto slices = Pipeline<AllDelay>(serverB, (rows + MAX_STREAM_CHUNK_ROWS - 1) / MAX_STREAM_CHUNK_ROWS, 1, deadline, [&](const char* port, const RequestId_t& id, const size_t begin, const size_t end) {
+			auto sendB = receiveHelper->SendHelper(HOST, port);
+			auto slice = AllShortestPath(shortestPath.mapInfo, shortestPath.sourceNode);
+			slice.distances.assign(shortestPath.distances.begin() + begin * MAX_STREAM_CHUNK_ROWS, shortestPath.distances.begin() + std::min(rows, end * MAX_STREAM_CHUNK_ROWS));
+			auto request = item;
+			request.requestId = id;
+			request.Encode(*sendB, slice);
+			return request.EncodedSize() + slice.EncodedSize();
+		});
+		cout << "The AWS has sent path length, propagation speed and transmission speed to server B in " << slices.size() << " slices using UDP over port " << udpPort << "." << endl;
+		auto result = AllDelay(0, Status::Ok);
+		for (const auto& slice : slices) {
+			result.delays.insert(result.delays.end(), slice.delays.begin(), slice.delays.end());
+		}
+		return result;
+	}
+};
+
+#ifdef FUSED
+
+// work item of an engine stage, owned by the submitter and the stage worker together: a submitter gives up at its deadline while the worker may still run the job,
+// so the job shares its input with the submitter and allocates its result on heap; stages hand each other results by pointer
+template <typename Result>
+struct StageJob {
+	const ClientQuery query;
+	std::shared_ptr<const AllShortestPath> shortestPath; // input of delay stage only, a result of the map stage on heap
+	std::shared_ptr<Result> result;
+	Status status = Status::Ok;
+	std::exception_ptr error;
+	Completion done; // set by the worker, awaited by the submitter
+
+	StageJob(const ClientQuery& _query, const std::shared_ptr<const AllShortestPath>& _shortestPath) : query(_query), shortestPath(_shortestPath) {}
+};
+
+// logic of server A and server B hosted in this process, stages exchange objects over lock-free queues without encoding
+class FusedBackend : public Backend {
+private:
+	typedef StageJob<AllShortestPath> MapJob;
+	typedef StageJob<AllDelay> DelayJob;
+
+	MapManager manager;
+	MpmcQueue<std::shared_ptr<MapJob>> mapQueue;
+	MpmcQueue<std::shared_ptr<DelayJob>> delayQueue;
+
+	template <typename Job, typename Work>
+	static void RunStage(MpmcQueue<std::shared_ptr<Job>>& queue, const Work& work) {
+		while (true) {
+			auto job = queue.Pop();
+			ArenaBinding heap(nullptr); // see StageJob
+			try {
+				if (job->query.Expired()) { // the submitter gives up at deadline anyway
+					job->status = Status::DeadlineExceeded;
+				} else {
+					work(*job);
+				}
+			} catch (...) {
+				job->error = std::current_exception();
+			}
+			job->done.Set();
+		}
+	}
+
+	// wait until job is done, or give it up at the deadline and leave it to the worker
+	template <typename Job>
+	static void Wait(Job& job, const Timestamp_t& deadline) {
+		if (!job.done.WaitUntil(deadline)) {
+			throw QueryFailedException(Status::DeadlineExceeded);
+		}
+	}
+
+	// rethrow the failure of a done job
+	template <typename Job>
+	static void Check(const Job& job) {
+		if (job.error) {
+			std::rethrow_exception(job.error);
+		}
+		if (job.status != Status::Ok) {
+			throw QueryFailedException(job.status);
+		}
+	}
+
+	// hand job to a stage, wait until it is done
+	template <typename Job>
+	static void Submit(MpmcQueue<std::shared_ptr<Job>>& queue, const std::shared_ptr<Job>& job, const Timestamp_t& deadline) {
+		queue.Push(job);
+		Wait(*job, deadline);
+		Check(*job);
+	}
+
+	// hand all jobs to a stage to run in parallel, wait until all are done, results in order
+	template <typename Result, typename Job>
+	static vector<std::shared_ptr<Result>> SubmitAll(MpmcQueue<std::shared_ptr<Job>>& queue, const vector<std::shared_ptr<Job>>& jobs, const Timestamp_t& deadline) {
+		for (const auto& job : jobs) {
+			queue.Push(job);
+		}
+		for (const auto& job : jobs) {
+			Wait(*job, deadline);
+		}
+		vector<std::shared_ptr<Result>> result;
+		result.reserve(jobs.size());
+		for (const auto& job : jobs) {
+			Check(*job);
+			result.push_back(job->result);
+		}
+		return result;
+	}
+
+public:
+	FusedBackend(const Options& options) : manager(options), mapQueue(FUSED_QUEUE_CAPACITY), delayQueue(FUSED_QUEUE_CAPACITY) {
+		for (auto i = 0; i < options.GetInt("map-workers", 1); i++) {
+			std::thread([this] {
+				RunStage(mapQueue, [this](MapJob& job) {
+					TraceScope span(job.query.traceId, "map engine search");
+					job.result = std::make_shared<AllShortestPath>(manager.CalcShortestPath(job.query));
+				});
+			}).detach();
+		}
+		for (auto i = 0; i < options.GetInt("delay-workers", 1); i++) {
+			std::thread([this] {
+				RunStage(delayQueue, [](DelayJob& job) {
+					TraceScope span(job.query.traceId, "delay engine");
+					job.result = std::make_shared<DefaultDelay>(job.query.fileSize, *job.shortestPath);
+				});
+			}).detach();
+		}
+	}
+
+	virtual AllShortestPath ShortestPath(const ClientQuery& query, const Timestamp_t& deadline) {
+		auto job = std::make_shared<MapJob>(query, nullptr);
+		cout << "The AWS has handed map ID and starting vertex to the map engine." << endl;
+		Submit(mapQueue, job, deadline);
+		return std::move(*job->result);
+	}
+
+	virtual AllDelay Delay(const ClientQuery& query, const std::shared_ptr<const AllShortestPath>& shortestPath, const Timestamp_t& deadline) {
+		auto job = std::make_shared<DelayJob>(query, shortestPath);
+		cout << "The AWS has handed path length, propagation speed and transmission speed to the delay engine." << endl;
+		Submit(delayQueue, job, deadline);
+		return std::move(*job->result);
+	}
+
+	virtual vector<std::shared_ptr<const AllShortestPath>> ShortestPaths(const BatchQuery& query, const Timestamp_t& deadline) {
+		vector<std::shared_ptr<MapJob>> jobs;
+		for (size_t i = 0; i < query.sources.size(); i++) {
+			jobs.push_back(std::make_shared<MapJob>(query.Single(i), nullptr));
+		}
+		cout << "The AWS has handed map ID and " << query.sources.size() << " starting vertices to the map engine." << endl;
+		auto results = SubmitAll<AllShortestPath>(mapQueue, jobs, deadline);
+		return vector<std::shared_ptr<const AllShortestPath>>(results.begin(), results.end());
+	}
+
+	virtual vector<AllDelay> Delays(const BatchQuery& query, const vector<std::shared_ptr<const AllShortestPath>>& shortestPaths, const Timestamp_t& deadline) {
+		vector<std::shared_ptr<DelayJob>> jobs;
+		for (size_t i = 0; i < query.sources.size(); i++) {
+			jobs.push_back(std::make_shared<DelayJob>(query.Single(i), shortestPaths[i]));
+		}
+		cout << "The AWS has handed path length, propagation speed and transmission speed of " << query.sources.size() << " starting vertices to the delay engine." << endl;
+		vector<AllDelay> result;
+		for (auto& delay : SubmitAll<AllDelay>(delayQueue, jobs, deadline)) {
+			result.push_back(std::move(*delay));
+		}
+		return result;
+	}
+
+	// chunks are calculated on the connection thread, a stream keeps its search between chunks so it cannot move between stage workers
+	virtual void Stream(const ClientQuery& query, const Timestamp_t& deadline, const std::function<void(const AllShortestPath&, const AllDelay&, bool)>& forward) {
+		auto stream = manager.OpenStream(query);
+		cout << "The AWS has opened a stream of the map engine." << endl;
+		while (true) {
+			if (query.Expired()) {
+				throw QueryFailedException(Status::DeadlineExceeded);
+			}
+			auto shortestPath = AllShortestPath(stream->Info(), query.sourceNode);
+			{
+				TraceScope span(query.traceId, "map engine chunk");
+				stream->Next(manager.StreamChunkRows(), shortestPath.distances);
+			}
+			auto last = stream->Done();
+			forward(shortestPath, DefaultDelay(query.fileSize, shortestPath), last);
+			if (last) {
+				return;
+			}
+		}
+	}
+};
+
+#endif
+
+// one reactor of main server: its own listener, backend and state; other reactors share only what the process has once,
+// the query log, the tracer, the pool of datagram buffers and standard output
 class Connection {
 private:
 	TcpServerSocketBuilder builder;
-	UdpReceiveSocketHelper udpReceiveHelper;
-	
-public:
-	Connection() : builder(TcpServerSocketBuilder(SERVER_AWS_TCP_PORT)), udpReceiveHelper(UdpReceiveSocketHelper(SERVER_AWS_UDP_PORT)){
-		cout << "The AWS is up and running." << endl;
+	QueryLog& queryLog;
+	std::unique_ptr<Backend> backend;
+	SingleFlight shortestPathFlights;
+	LatencyWindow queryLatency;
+	AdmissionControl admissionControl;
+	Timestamp_t defaultDeadline; // applied when client gives none, 0 means no deadline
+	std::mutex printMutex; // keeps printed tables of concurrent queries apart
+
+	static std::unique_ptr<Backend> CreateBackend(const Options& options, const int reactor) {
+		if (!options.Has("fused")) {
+			return std::unique_ptr<Backend>(new UdpBackend(options, reactor));
+		}
+#ifdef FUSED
+		return std::unique_ptr<Backend>(new FusedBackend(options));
+#else
+		throw ArgumentException("Fused mode needs the awsFused build");
+#endif
 	}
 
-	void Process() {
-		while (auto child = builder.Accept()) {
-			//receive from client
-			auto query = ClientQuery(*child);
-			cout << "The AWS has received map ID " << query.mapName << ", start vertex " << query.sourceNode << " and file size " << query.fileSize << " from the client using TCP over port " << SERVER_AWS_TCP_PORT << endl;
-
-			//query server A
-			auto sendA = udpReceiveHelper.SendHelper(HOST, SERVER_A_PORT);
-			query.Encode(*sendA);
-			cout << "The AWS has sent map ID and starting vertex to server A using UDP over port " << SERVER_AWS_UDP_PORT << "." << endl;
-			auto shortestPath = AllShortestPath(udpReceiveHelper);
+	// wall clock deadline of query to monotonic time point
+	template <typename Query>
+	static Timestamp_t LocalDeadline(const Query& query) {
+		return query.deadline == 0 ? -1 : NowMicroseconds() + (query.deadline - WallClockMicroseconds());
+	}
+
+	// query server A then server B, and send response to client
+	void Answer(ClientQuery& query, SocketHelper& child) {
+		auto deadline = LocalDeadline(query);
+
+		//query server A, shared by identical queries in flight
+		auto joined = false;
+		auto shortestPath = shortestPathFlights.Get(query, deadline, joined, [&] {
+			return backend->ShortestPath(query, deadline);
+		});
+		{
+			std::lock_guard<std::mutex> lock(printMutex);
+			if (joined) {
+				cout << "The AWS has shared an in-flight request to server A, coalescing ratio " << shortestPathFlights.Ratio() << "." << endl;
+			}
 			cout << "The AWS has received shortest path from server A:" << endl;
-			shortestPath.Print();
-
-			//query server B
-			auto sendB = udpReceiveHelper.SendHelper(HOST, SERVER_B_PORT);
-			query.Encode(*sendB);
-			shortestPath.Encode(*sendB);
-			cout << "The AWS has sent path length, propagation speed and transmission speed to server B using UDP over port " << SERVER_AWS_UDP_PORT <<"." << endl;
-			auto delay = AllDelay(udpReceiveHelper);
+			shortestPath->Print();
+		}
+
+		//query server B, with the file size of this query
+		auto delay = backend->Delay(query, shortestPath, deadline);
+		{
+			std::lock_guard<std::mutex> lock(printMutex);
 			cout << "The AWS has received delays from server B:" << endl;
 			delay.Print();
+		}
+
+		//response to client
+		{
+			TraceScope span(query.traceId, "aws encode response");
+			auto response = Response(*shortestPath, delay);
+			response.Encode(child);
+		}
+		cout << "The AWS has sent calculated delay to client using TCP over port " << SERVER_AWS_TCP_PORT << "." << endl;
+	}
+
+	// query server A for all sources then server B, and send all results to client in one response
+	void AnswerBatch(const BatchQuery& query, SocketHelper& child) {
+		auto deadline = LocalDeadline(query);
+
+		auto shortestPaths = backend->ShortestPaths(query, deadline);
+		cout << "The AWS has received shortest paths of " << shortestPaths.size() << " starting vertices from server A." << endl;
+
+		auto delays = backend->Delays(query, shortestPaths, deadline);
+		cout << "The AWS has received delays of " << delays.size() << " starting vertices from server B." << endl;
+
+		{
+			TraceScope span(query.traceId, "aws encode response");
+			BatchResponse(shortestPaths, delays).Encode(child);
+		}
+		cout << "The AWS has sent calculated delays of " << query.sources.size() << " starting vertices to client using TCP over port " << SERVER_AWS_TCP_PORT << "." << endl;
+	}
+
+	// results are sent to client a chunk at a time as they come, nothing of a chunk is kept after it is sent
+	void AnswerStream(const ClientQuery& query, SocketHelper& child) {
+		ArenaBinding heap(nullptr); // the arena of this connection would grow with the map
+		auto deadline = LocalDeadline(query);
+		auto rows = size_t(0);
+		auto chunks = 0;
+		Timestamp_t firstChunk = -1;
+		auto start = NowMicroseconds();
+		backend->Stream(query, deadline, [&](const AllShortestPath& shortestPath, const AllDelay& delay, const bool last) {
+			{
+				TraceScope span(query.traceId, "aws encode chunk");
+				ResponseChunk(shortestPath, delay, last).Encode(child);
+			}
+			rows += shortestPath.distances.size();
+			chunks++;
+			if (firstChunk < 0) {
+				firstChunk = NowMicroseconds() - start;
+			}
+		});
+		cout << "The AWS has streamed " << rows << " calculated delays in " << chunks << " chunks to client using TCP over port " << SERVER_AWS_TCP_PORT
+			<< ", first chunk after " << firstChunk / 1000.0 << " ms, last after " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+	}
 
-			//response to client
-			auto response = Response(shortestPath, delay);
-			response.Encode(*child);
-			cout << "The AWS has sent calculated delay to client using TCP over port " << SERVER_AWS_TCP_PORT << "." << endl;
+	// admission, failure reply and latency statistics of a query of either kind, Reply is the response type of the kind
+	template <typename Reply, typename Query, typename Answer>
+	void Handle(Query& query, SocketHelper& child, const Timestamp_t& start, const Answer& answer) {
+		if (query.deadline == 0 && defaultDeadline > 0) {
+			query.deadline = WallClockMicroseconds() + defaultDeadline;
+		}
+		auto admission = admissionControl.Admit(query);
+		if (admission != Status::Ok) {
+			Reply(admission).Encode(child);
+			cout << "The AWS has rejected the query: " << StatusText(admission) << "." << endl;
+			queryLog.Append(query, admission, NowMicroseconds() - start);
+			return;
+		}
+		auto status = Status::Ok;
+		try {
+			answer();
+		} catch (const QueryFailedException& ex) {
+			status = ex.status;
+			Reply(ex.status).Encode(child);
+			cout << "The AWS has sent failure to client: " << StatusText(ex.status) << "." << endl;
+		}
+
+		auto latency = NowMicroseconds() - start;
+		queryLatency.Add(latency);
+		queryLog.Append(query, status, latency);
+		if (backend->Hedging()) {
+			std::lock_guard<std::mutex> lock(printMutex);
+			backend->PrintStatistics();
+			cout << "The AWS query latency is p50 " << queryLatency.Percentile(50) / 1000.0 << " ms, p99 " << queryLatency.Percentile(99) / 1000.0 << " ms." << endl;
+		}
+	}
+
+	// sample a query for tracing, and record how it got here: accepted is when its connection was accepted if this is the first query of it, else 0
+	template <typename Query>
+	static void TraceArrival(Query& query, const Timestamp_t& accepted, const Timestamp_t& received) {
+		auto& tracer = Tracer::Instance();
+		query.traceId = tracer.Sample();
+		if (accepted != 0) {
+			tracer.Record(query.traceId, "aws accept", accepted, received);
+		}
+		tracer.Record(query.traceId, "aws decode query", received, WallClockMicroseconds());
+	}
+
+	// receive one query from client and answer it
+	void ServeQuery(TcpServerSocketHelper& child, const Timestamp_t& accepted) {
+		auto received = WallClockMicroseconds();
+		if (child.Peek<QueryKind>() == QueryKind::Batch) {
+			auto query = BatchQuery(child);
+			TraceArrival(query, accepted, received);
+			TraceScope span(query.traceId, "aws query");
+			auto start = NowMicroseconds();
+			cout << "The AWS has received map ID " << query.mapName << ", " << query.sources.size() << " start vertices and file size " << query.fileSize << " from the client using TCP over port " << SERVER_AWS_TCP_PORT << endl;
+			Handle<BatchResponse>(query, child, start, [&] { AnswerBatch(query, child); });
+			return;
+		}
+		auto query = ClientQuery(child);
+		TraceArrival(query, accepted, received);
+		TraceScope span(query.traceId, "aws query");
+		auto start = NowMicroseconds();
+		cout << "The AWS has received map ID " << query.mapName << ", start vertex " << query.sourceNode;
+		if (query.destination != ALL_DESTINATIONS) {
+			cout << ", destination " << query.destination;
+		}
+		cout << " and file size " << query.fileSize << " from the client using TCP over port " << SERVER_AWS_TCP_PORT << endl;
+		if (query.kind == QueryKind::Stream) {
+			Handle<ResponseChunk>(query, child, start, [&] { AnswerStream(query, child); });
+			return;
+		}
+		Handle<Response>(query, child, start, [&] { Answer(query, child); });
+	}
+
+	// serve one client connection, runs in its own thread; a pooled connection carries one query after another until the client closes it
+	void Serve(const std::shared_ptr<TcpServerSocketHelper> child, Timestamp_t accepted) {
+		try {
+			while (child->WaitMessage()) {
+				RequestArenaScope arenaScope; // messages of this query are released together after it is answered
+				ServeQuery(*child, accepted);
+				accepted = 0;
+			}
+		} catch (const std::exception& ex) {
+			std::cerr << ex.what() << endl;
+		}
+	}
+
+public:
+	// listeners of several reactors share the TCP port by SO_REUSEPORT
+	Connection(const Options& options, const int reactor, const int reactors, QueryLog& _queryLog) : builder(TcpServerSocketBuilder(SERVER_AWS_TCP_PORT, reactors > 1)), queryLog(_queryLog),
+		backend(CreateBackend(options, reactor)), admissionControl(options), defaultDeadline(options.GetInt("default-deadline-ms", 0) * 1000) {
+		if (reactors > 1) {
+			cout << "The AWS reactor " << reactor << " is up and running." << endl;
+			return;
+		}
+		cout << "The AWS is up and running." << endl;
+	}
+
+	void Process() {
+		while (true) {
+			std::shared_ptr<TcpServerSocketHelper> child = builder.Accept();
+			std::thread(&Connection::Serve, this, child, WallClockMicroseconds()).detach();
 		}
 	}
 };
 
-int main() {
+int main(int argc, char* argv[]) {
 	try {
-		auto client = Connection();
-		client.Process();
+		auto options = Options(argc, argv);
+		Tracer::Instance().Configure(options, "aws");
+		auto reactors = options.GetInt("reactors", 1);
+		if (reactors < 1 || reactors > MAX_AWS_REACTORS) {
+			throw ArgumentException("Reactors should be between 1 and " + std::to_string(MAX_AWS_REACTORS));
+		}
+		if (reactors > 1 && options.Has("fused")) {
+			throw ArgumentException("Each reactor has its own backend, fused mode would keep every map once per reactor");
+		}
+		QueryLog queryLog(options); // before any backend, which starts threads
+		if (reactors == 1) {
+			Connection client(options, 0, 1, queryLog);
+			client.Process();
+			return 0;
+		}
+		// reactor r runs on core r modulo the cores, with the threads of its backend and connections
+		auto cores = std::max(1u, std::thread::hardware_concurrency());
+		vector<std::unique_ptr<Connection>> clients;
+		for (auto reactor = 0; reactor < reactors; reactor++) {
+			PinToCore(reactor % cores);
+			clients.emplace_back(new Connection(options, reactor, reactors, queryLog));
+		}
+		for (auto reactor = 1; reactor < reactors; reactor++) {
+			std::thread([&clients, reactor, cores] {
+				PinToCore(reactor % cores);
+				clients[reactor]->Process();
+			}).detach();
+		}
+		PinToCore(0);
+		clients[0]->Process();
 	} catch (const std::exception & ex) {
 		std::cerr << ex.what() << endl;
 	}
@@ -0,0 +1,179 @@
+#include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "common.hpp"
+#include "awsClient.hpp"
+#include "queryLog.hpp"
+
+using std::cout;
+using std::endl;
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const int DEFAULT_REPLAY_CONNECTIONS = 16;
+
+//===============================================//
+//                     Tool                      //
+//===============================================//
+
+// percentile in [0, 100] of sorted samples, in milliseconds
+double PercentileMilliseconds(const vector<Timestamp_t>& sorted, const double percentile) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	return sorted[std::min(sorted.size() - 1, (size_t)(percentile / 100 * sorted.size()))] / 1000.0;
+}
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+// outcomes of replayed queries, filled by connection threads
+class ReplayResults {
+private:
+	std::mutex mutex;
+	std::condition_variable finished;
+	size_t pending = 0;
+	vector<Timestamp_t> latencies; // from when the query was due, so that queueing in the client counts
+	size_t failed = 0; // broken connection, or a status other than Ok
+	size_t changed = 0; // status differs from the recorded one
+
+public:
+	void Expect() {
+		std::lock_guard<std::mutex> lock(mutex);
+		pending++;
+	}
+
+	// outcome of a query due at the given time, a failure when status is not given
+	void Done(const QueryLogRecord& record, const Timestamp_t& due, const Status* status) {
+		auto latency = NowMicroseconds() - due;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			latencies.push_back(latency);
+			failed += status == nullptr || *status != Status::Ok;
+			changed += status == nullptr || *status != record.status;
+			pending--;
+		}
+		finished.notify_all();
+	}
+
+	void Wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this] { return pending == 0; });
+	}
+
+	void Print(const vector<QueryLogRecord>& records, const double seconds) {
+		std::lock_guard<std::mutex> lock(mutex);
+		vector<Timestamp_t> recorded;
+		for (const auto& record : records) {
+			recorded.push_back(record.latency);
+		}
+		std::sort(recorded.begin(), recorded.end());
+		std::sort(latencies.begin(), latencies.end());
+		cout << "The replay has sent " << records.size() << " queries in " << seconds << " s, " << failed << " failed, " << changed << " with a status other than recorded." << endl;
+		cout << "-------------------------------------------------" << endl;
+		cout << left << setw(12) << "Latency ms" << setw(12) << "p50" << setw(12) << "p99" << setw(12) << "max" << endl;
+		cout << "-------------------------------------------------" << endl;
+		cout << setw(12) << "recorded" << setw(12) << PercentileMilliseconds(recorded, 50) << setw(12) << PercentileMilliseconds(recorded, 99) << setw(12) << PercentileMilliseconds(recorded, 100) << endl;
+		cout << setw(12) << "replayed" << setw(12) << PercentileMilliseconds(latencies, 50) << setw(12) << PercentileMilliseconds(latencies, 99) << setw(12) << PercentileMilliseconds(latencies, 100) << endl;
+		cout << "-------------------------------------------------" << endl;
+	}
+};
+
+// sends each query of a log at its recorded arrival time relative to the first, divided by the speed-up
+// queries are not held back by slow answers, with too few connections they wait in the client and their latency shows it
+class Replay {
+private:
+	ReplayResults results;
+	AwsClient client; // destroyed first, its threads report into results
+
+	template <typename Reply>
+	static Status StatusOf(const Reply& reply) {
+		return reply.status;
+	}
+
+	static Status StatusOf(const Status& status) {
+		return status;
+	}
+
+	template <typename Reply>
+	std::function<void(std::future<Reply>)> Outcome(const QueryLogRecord& record, const Timestamp_t& due) {
+		return [this, &record, due](std::future<Reply> reply) {
+			try {
+				auto status = StatusOf(reply.get());
+				results.Done(record, due, &status);
+			} catch (const std::exception&) {
+				results.Done(record, due, nullptr);
+			}
+		};
+	}
+
+	void Send(const QueryLogRecord& record, const Timestamp_t& due) {
+		results.Expect();
+		if (record.kind == QueryKind::Batch) {
+			client.Submit(record.Batch(), Outcome<BatchResponse>(record, due));
+		} else if (record.kind == QueryKind::Stream) {
+			client.Stream(record.Query(), [](const ResponseChunk&) {}, Outcome<Status>(record, due));
+		} else {
+			client.Submit(record.Query(), Outcome<Response>(record, due));
+		}
+	}
+
+public:
+	explicit Replay(const size_t connections) : client(HOST, SERVER_AWS_TCP_PORT, connections) {}
+
+	void Run(vector<QueryLogRecord>& records, const double speed) {
+		std::stable_sort(records.begin(), records.end(), [](const QueryLogRecord& a, const QueryLogRecord& b) {
+			return a.arrival < b.arrival;
+		});
+		auto start = NowMicroseconds();
+		auto origin = records.empty() ? 0 : records.front().arrival;
+		auto lag = Timestamp_t(0); // most a query was sent after it was due
+		for (const auto& record : records) {
+			auto due = start + (Timestamp_t)((record.arrival - origin) / speed);
+			auto now = NowMicroseconds();
+			if (due > now) {
+				std::this_thread::sleep_for(std::chrono::microseconds(due - now));
+			}
+			lag = std::max(lag, NowMicroseconds() - due);
+			Send(record, due);
+		}
+		results.Wait();
+		results.Print(records, (NowMicroseconds() - start) / 1000000.0);
+		cout << "The replay has sent queries at most " << lag / 1000.0 << " ms after they were due." << endl;
+	}
+};
+
+//===============================================//
+//                    Main                       //
+//===============================================//
+
+// ./queryReplay <query log> [--speed=1] [--connections=16]
+int main(int argc, char* argv[]) {
+	try {
+		auto options = Options(argc, argv);
+		if (options.Positional().size() != 1) {
+			throw ArgumentException("Usage: ./queryReplay <query log> [--speed=1] [--connections=16]");
+		}
+		auto speed = options.GetDouble("speed", 1);
+		if (speed <= 0) {
+			throw ArgumentException("Speed should be positive");
+		}
+		auto connections = options.GetInt("connections", DEFAULT_REPLAY_CONNECTIONS);
+		if (connections < 1) {
+			throw ArgumentException("Connections should be at least 1");
+		}
+		auto records = QueryLog::Read(options.Positional()[0]);
+		cout << "The replay has read " << records.size() << " queries from " << options.Positional()[0] << "." << endl;
+		Replay replay(connections);
+		replay.Run(records, speed);
+	} catch (const std::exception& ex) {
+		std::cerr << ex.what() << endl;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -1,27 +1,21 @@
-#include <unordered_map>
-#include <map>
-#include <unordered_set>
-#include <set>
-#include <fstream>
-#include <regex>
-#include <algorithm>
 #include <iostream>
-#include <iomanip>
 #include <string>
+#include <algorithm>
+#include <thread>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
 
 #include "common.hpp"
+#include "sharedMemory.hpp"
+#include "mapEngine.hpp"
+#include "partition.hpp"
+#include "threadPool.hpp"
+#include "trace.hpp"
+#include "queryLog.hpp"
 
-using std::unordered_map;
-using std::map;
-using std::unordered_set;
-using std::set;
 using std::cout;
-using std::left;
-using std::setw;
 using std::endl;
 using std::string;
 
@@ -29,262 +23,313 @@ using std::string;
 //                    Const                      //
 //===============================================//
 
-const string MAP_FILENAME = "map.txt";
-
-//===============================================//
-//                     Tool                      //
-//===============================================//
-
-// split string to tokens
-vector<string> Split(const string& str, const string& regexStr) {
-	auto regex = std::regex(regexStr);
-	auto begin = std::sregex_token_iterator(str.begin(), str.end(), regex, -1);
-	auto end = std::sregex_token_iterator();
-	return { begin, end };
-}
+const int MAX_STREAMS = 64; // open streams at a time, a new one is rejected beyond
+const Timestamp_t STREAM_IDLE_TIMEOUT = 10000000; // microseconds without a request before a stream is closed
+const int DEFAULT_WARM_SOURCES = 64;
 
 //===============================================//
 //                    Class                      //
 //===============================================//
 
-class FileNotFoundException : public EE450Exception {
-public:
-	explicit FileNotFoundException(const string& filename) :EE450Exception("Missing file \"" + filename + "\""){}
-};
-
-class MapFormatException : public ArgumentException {
-public:
-	explicit MapFormatException(const int lineNumber, const string& line) : ArgumentException("Worng map format at line " + std::to_string(lineNumber) + ": " + line) {}
+// stream in progress, kept between the requests of its windows
+struct StreamSession {
+	std::unique_ptr<ShortestPathStream> stream;
+	int nextSequence = 0;
+	size_t rows = 0;
+	Timestamp_t lastUsed = 0;
+	RequestId_t traceId = 0;
 };
 
-class IllegalEdgeException : public ArgumentException{
-public:
-	explicit IllegalEdgeException(const Node_t& src, const Node_t& dest, const Distance_t& dist) : ArgumentException("Illegal edge from " + std::to_string(src) + " to " + std::to_string(dest) + " with distance " + std::to_string(dist)) {}
-};
+// results of the sources queried most often in a query log of the AWS, calculated at startup so that a restart does not begin cold
+// only queries for all destinations without bounds are answered from here; read only once warmed, so batch threads share it
+class HotSources {
+private:
+	typedef std::pair<char, Node_t> Key;
 
-class EdgeExistedException : public ArgumentException {
-public:
-	explicit EdgeExistedException(const Node_t& src, const Node_t& dest) : ArgumentException("Edge from " + std::to_string(src) + " to " + std::to_string(dest) + " already existed") {}
-};
+	map<Key, AllShortestPath> results;
 
-class MapNotFoundException : public EE450Exception {
 public:
-	explicit MapNotFoundException(const char mapId) :EE450Exception("Map " + string(1, mapId) + " not found") {}
-};
+	// ties by map and vertex
+	void Warm(const MapManager& manager, const string& filename, const size_t limit) {
+		auto start = NowMicroseconds();
+		auto records = QueryLog::Read(filename);
+		map<Key, long long> counts;
+		for (const auto& record : records) {
+			for (const auto& source : record.sources) {
+				counts[Key(record.mapName, source)]++;
+			}
+		}
+		vector<std::pair<long long, Key>> ranked;
+		for (const auto& count : counts) {
+			ranked.emplace_back(-count.second, count.first);
+		}
+		std::sort(ranked.begin(), ranked.end());
+		ArenaBinding heap(nullptr); // kept for the life of the server
+		for (size_t i = 0; i < ranked.size() && results.size() < limit; i++) {
+			const auto& key = ranked[i].second;
+			try {
+				results.emplace(key, manager.CalcShortestPath(key.first, key.second));
+			} catch (const MapNotFoundException&) { // logged against another map file
+			} catch (const VertexNotFoundException&) {
+			}
+		}
+		cout << "The Server A has warmed " << results.size() << " hot sources out of " << counts.size() << " sources in " << records.size() << " logged queries in " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
+	}
 
-class VertexNotFoundException : public EE450Exception {
-public:
-	explicit VertexNotFoundException(const Node_t& node) :EE450Exception("Vertex " + std::to_string(node) + " not found") {}
+	// null unless query is answered from here
+	const AllShortestPath* Find(const ClientQuery& query) const {
+		if (results.empty() || query.destination != ALL_DESTINATIONS || query.Bounded()) {
+			return nullptr;
+		}
+		auto it = results.find(Key(query.mapName, query.sourceNode));
+		return it == results.end() ? nullptr : &it->second;
+	}
 };
 
-class Map {
+class Connection {
 private:
-	MapInfo mapInfo;
-	unordered_map<Node_t, map<Node_t, Distance_t>> value;
+	std::unique_ptr<DatagramReceiveHelper> receiveHelper;
+	DelayInjector delayInjector;
+	AdmissionControl admissionControl;
+	ThreadPool pool; // runs the sources of a batch query
+	map<RequestId_t, StreamSession> streams;
+	std::unique_ptr<PartitionCoordinator> coordinator; // null unless the maps are partitioned
+	HotSources hotSources;
+
+	// on partitioned maps the search runs across all partitions
+	AllShortestPath CalcShortestPath(const MapManager& manager, const ClientQuery& query) {
+		TraceScope span(query.traceId, "server A search");
+		auto hot = hotSources.Find(query);
+		if (hot != nullptr) {
+			return *hot;
+		}
+		return coordinator ? coordinator->CalcShortestPath(manager, query) : manager.CalcShortestPath(query);
+	}
 
-	void AddDirectedEdge(const Node_t& src, const Node_t& dest, const Distance_t distance) {
-		if (src == dest || distance < 0) {
-			throw IllegalEdgeException(src, dest, distance);
+	// admission of a query, true if it should be answered; Reply is the message telling the AWS of a rejection
+	template <typename Reply = AllShortestPath, typename Query>
+	bool Admit(const Query& query) {
+		auto admission = admissionControl.Admit(query);
+		if (admission == Status::DeadlineExceeded) { // nobody waits for the result
+			cout << "The Server A has dropped the query since its deadline has passed." << endl;
+			return false;
 		}
-		auto ret = value.emplace(src, map<Node_t, Distance_t>());
-		if (!ret.second) {
-			//throw EdgeExistedException(src, dest);
+		if (admission == Status::Overloaded) { // reject quickly, so that the AWS need not wait
+			auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(query.requestId));
+			Reply(query.requestId, admission).Encode(*sendHelper);
+			cout << "The Server A has rejected the query since it is overloaded." << endl;
+			return false;
 		}
-		auto& edges = ret.first->second;
-		edges[dest] = distance;
+		return true;
 	}
-public:
-	Map() {}
-	Map(const MapInfo& _mapInfo) : mapInfo(_mapInfo) {}
 
-	void AddUndirectedEdge(const Node_t& src, const Node_t& dest, const Distance_t distance) {
-		AddDirectedEdge(src, dest, distance);
-		AddDirectedEdge(dest, src, distance);
+	// run answer, a request that cannot be answered is told so by a Reply with the reason instead of ending the server
+	template <typename Reply = AllShortestPath, typename Answer>
+	void Guard(const RequestId_t& requestId, const Answer& answer) {
+		auto status = Status::Ok;
+		try {
+			answer();
+			return;
+		} catch (const MapNotFoundException& ex) {
+			status = Status::NotFound;
+			std::cerr << ex.what() << endl;
+		} catch (const VertexNotFoundException& ex) {
+			status = Status::NotFound;
+			std::cerr << ex.what() << endl;
+		} catch (const TooLargePayloadException& ex) {
+			status = Status::TooLarge;
+			std::cerr << ex.what() << endl;
+		}
+		auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(requestId));
+		Reply(requestId, status).Encode(*sendHelper);
 	}
 
-	int VertexCount() const {
-		return value.size();
+	// sources run in parallel, the result of each source is sent as its own datagram as soon as it is ready
+	void ProcessBatch(const MapManager& manager) {
+		auto query = BatchQuery(*receiveHelper);
+		TraceQueued(query, "queue to server A");
+		cout << "The Server A has received input for finding shortest paths: " << query.sources.size() << " starting vertices of map " << query.mapName << "." << endl;
+		if (!Admit(query)) {
+			return;
+		}
+
+		auto start = NowMicroseconds();
+		delayInjector.Inject();
+		pool.ParallelFor(query.sources.size(), [&](const size_t index, const size_t worker) {
+			RequestArenaScope arenaScope;
+			Guard(query.requestId + index, [&] { // one bad source fails only its own reply
+				auto shortestPath = CalcShortestPath(manager, query.Single(index));
+				shortestPath.requestId = query.requestId + index;
+				TraceScope span(query.traceId, "server A send");
+				auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(query.requestId));
+				shortestPath.Encode(*sendHelper);
+			});
+		});
+		cout << "The Server A has sent shortest paths of " << query.sources.size() << " starting vertices to AWS using " << pool.Size() << " threads in " << (NowMicroseconds() - start) / 1000.0 << " ms." << endl;
 	}
 
-	int UndirectedEdgeCount() const {
-		auto result = 0;
-		for (const auto& edgeSet : value) {
-			result += edgeSet.second.size();
+	// next window of chunks of a stream, the stream is closed after its last chunk
+	void SendWindow(const RequestId_t& requestId, StreamSession& session, const size_t chunkRows) {
+		TraceScope span(session.traceId, "server A stream window");
+		auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(requestId));
+		for (auto i = 0; i < STREAM_WINDOW_CHUNKS; i++) {
+			auto chunk = ShortestPathChunk(session.stream->Info());
+			chunk.requestId = requestId;
+			chunk.sequence = session.nextSequence++;
+			session.stream->Next(chunkRows, chunk.distances);
+			chunk.last = session.stream->Done();
+			session.rows += chunk.distances.size();
+			chunk.Encode(*sendHelper);
+			if (chunk.last) {
+				cout << "The Server A has streamed " << session.rows << " shortest paths to AWS in " << session.nextSequence << " chunks." << endl;
+				streams.erase(requestId);
+				return;
+			}
 		}
-		return result / 2;
+		session.lastUsed = NowMicroseconds();
 	}
 
-	AllShortestPath CalcShortestPath(const Node_t& src) const {
-		if (value.find(src) == value.end()) {
-			throw VertexNotFoundException(src);
-		}
-		auto result = AllShortestPath(mapInfo, src);
-		//Dijkstra
-		auto included = unordered_set<Node_t>();
-		auto& distance = result.distances; // directly update result's field
-		// init
-		distance[src] = 0;
-		// calc
-		for (auto i = 0; i < VertexCount(); i++) {
-			// find nearest
-			auto newNode = Node_t();
-			auto minDist = std::numeric_limits<Distance_t>::max();
-			for (const auto& edgeSet : value) {
-				auto& testNode = edgeSet.first;
-				if (included.find(testNode) == included.end()) {// only not included nodes
-					const auto& distElem = distance.find(testNode);
-					const auto& testDist = distElem != distance.end() ? distElem->second : std::numeric_limits<Distance_t>::max();
-					if (testDist < minDist) {// record nearest
-						minDist = testDist;
-						newNode = testNode;
-					}
-				}
-			}
-			// update
-			included.insert(newNode);
-			for (const auto& edge : value.at(newNode)) {
-				const auto& updateNode = edge.first;
-				const auto& distElem = distance.find(updateNode);
-				const auto& currentDist = distElem != distance.end() ? distElem->second : std::numeric_limits<Distance_t>::max();
-				auto newDist = minDist + edge.second;
-				if (newDist < currentDist) {
-					distance[updateNode] = newDist;
-				}
+	// close streams the AWS has given up on
+	void ExpireStreams() {
+		auto now = NowMicroseconds();
+		for (auto it = streams.begin(); it != streams.end();) {
+			if (now - it->second.lastUsed > STREAM_IDLE_TIMEOUT) {
+				cout << "The Server A has closed an idle stream." << endl;
+				it = streams.erase(it);
+			} else {
+				it++;
 			}
 		}
-		distance.erase(src); // remove source node from result
-		return result;
 	}
-};
-
-enum class ReadLineState {
-	Normal,
-	PropagationSpeed,
-	TransmissionSpeed,
-};
-
-class MapManager {
-private:
-	map<char, Map> maps;
 
-	void BuildFromFile(const string& filename) {
-		maps = map<char, Map>();
-		auto file = std::ifstream(filename);
-		if (!file.is_open()) {
-			throw FileNotFoundException(filename);
-		}
-		auto state = ReadLineState::Normal;
-		string name;
-		PropagationSpeed_t pSpeed;
-		TransmissionSpeed_t tSpeed;
-		MapInfo info;
-		Node_t src;
-		Node_t dest;
-		Distance_t dist;
-		Map map;
-		int lineNumber = 0;
-		for (string line; getline(file, line);) { // read lines
-			lineNumber++;
-			if (line.size() == 0 || std::all_of(line.begin(), line.end(), isspace)) {// empty line
-				continue;
+	// a stream is opened with its first window, each later request of the AWS takes the next window
+	void ProcessStream(const MapManager& manager) {
+		auto query = ClientQuery(*receiveHelper);
+		TraceQueued(query, "queue to server A");
+		ExpireStreams();
+		if (query.kind == QueryKind::StreamNext) {
+			auto it = streams.find(query.requestId);
+			if (it != streams.end()) { // else closed already
+				SendWindow(query.requestId, it->second, manager.StreamChunkRows());
 			}
-			auto tokens = Split(line, R"(\s+)");
-			try {
-				switch (state) {
-				case ReadLineState::Normal:
-					switch (tokens.size()) {
-					case 1:// new map id
-						if (!name.empty()) {
-							maps[info.name] = std::move(map); // store last map
-						}
-						name = tokens[0];
-						state = ReadLineState::PropagationSpeed;
-						break;
-					case 3:// new edge
-						src = std::stoi(tokens[0]);
-						dest = std::stoi(tokens[1]);
-						dist = std::stoi(tokens[2]);
-						map.AddUndirectedEdge(src, dest, dist);
-						break;
-					default:
-						throw std::invalid_argument(line);
-					}
-					break;
-				case ReadLineState::PropagationSpeed:
-					pSpeed = std::stod(tokens[0]);
-					state = ReadLineState::TransmissionSpeed;
-					break;
-				case ReadLineState::TransmissionSpeed:
-					tSpeed = std::stod(tokens[0]);
-					assert(name.size() == 1);
-					info = MapInfo(name[0], pSpeed, tSpeed); // assembly map info
-					map = Map(info);
-					state = ReadLineState::Normal;
-					break;
+			return;
+		}
+		cout << "The Server A has received input for streaming shortest paths: starting vertex " << query.sourceNode << " of map " << query.mapName << "." << endl;
+		if (!Admit<ShortestPathChunk>(query)) {
+			return;
+		}
+		if (streams.size() >= MAX_STREAMS) {
+			auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(query.requestId));
+			ShortestPathChunk(query.requestId, Status::Overloaded).Encode(*sendHelper);
+			cout << "The Server A has rejected the stream since " << streams.size() << " streams are open." << endl;
+			return;
+		}
+		Guard<ShortestPathChunk>(query.requestId, [&] {
+			std::unique_ptr<ShortestPathStream> stream;
+			if (coordinator) { // the whole result first, then drained
+				auto result = coordinator->CalcShortestPath(manager, query);
+				if (result.status != Status::Ok) {
+					auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(query.requestId));
+					ShortestPathChunk(query.requestId, result.status).Encode(*sendHelper);
+					return;
 				}
-			} catch (...) {
-				throw MapFormatException(lineNumber, line);
+				stream = manager.OpenStream(result);
+			} else {
+				stream = manager.OpenStream(query);
 			}
-		}
-		maps[info.name] = std::move(map); // store last map
+			auto& session = streams[query.requestId];
+			session.stream = std::move(stream);
+			session.traceId = query.traceId;
+			delayInjector.Inject();
+			SendWindow(query.requestId, session, manager.StreamChunkRows());
+		});
 	}
 
-	void Print() const {
-		const int colWidth[] = { 8, 14, 11 };
-		cout << left;
-		cout << "The Server A has constructed a list of " << maps.size() << " maps:" << endl;
-		cout << "-------------------------------------------" << endl;
-		cout << setw(colWidth[0]) << "Map ID" << setw(colWidth[1]) << "Num Vertices" << setw(colWidth[2]) << "Num Edges" << endl;
-		cout << "-------------------------------------------" << endl;
-		for (const auto& m : maps) {
-			cout << setw(colWidth[0]) << m.first << setw(colWidth[1]) << m.second.VertexCount() << setw(colWidth[2]) << m.second.UndirectedEdgeCount() << endl;
+	// one query of any kind
+	void ProcessQuery(const MapManager& manager) {
+		auto kind = receiveHelper->Peek<QueryKind>();
+		if (kind == QueryKind::Batch) {
+			ProcessBatch(manager);
+			return;
 		}
-		cout << "-------------------------------------------" << endl;
-	}
+		if (kind == QueryKind::Stream || kind == QueryKind::StreamNext) {
+			ProcessStream(manager);
+			return;
+		}
+		auto query = ClientQuery(*receiveHelper);
+		TraceQueued(query, "queue to server A");
+		cout << "The Server A has received input for finding shortest paths: starting vertex " << query.sourceNode;
+		if (query.destination != ALL_DESTINATIONS) {
+			cout << " to destination " << query.destination;
+		}
+		cout << " of map " << query.mapName << "." << endl;
 
-public:
-	MapManager() {
-		BuildFromFile(MAP_FILENAME);
-		Print();
+		if (!Admit(query)) {
+			return;
+		}
+
+		Guard(query.requestId, [&] {
+			auto shortestPath = CalcShortestPath(manager, query);
+			cout << "The Server A has identified the following shortest paths:" << endl;
+			shortestPath.Print();
+			shortestPath.requestId = query.requestId;
+
+			delayInjector.Inject();
+			{
+				TraceScope span(query.traceId, "server A send");
+				auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(query.requestId));
+				shortestPath.Encode(*sendHelper);
+			}
+			cout << "The Server A has sent shortest paths to AWS." << endl;
+		});
 	}
 
-	AllShortestPath CalcShortestPath(const char map, const Node_t& src) const {
-		if (maps.find(map) == maps.end()) {
-			throw MapNotFoundException(map);
+public:
+	Connection(const string& port, const Options& options) : receiveHelper(OpenDatagramReceiver(options, port)), delayInjector(options), admissionControl(options),
+		pool(options.GetInt("threads", std::max(1u, std::thread::hardware_concurrency()))) {
+		if (!ParsePartition(options.Get("partition", "0/1")).Whole()) {
+			coordinator.reset(new PartitionCoordinator(options));
+		}
+		if (coordinator && options.Has("warm-up")) {
+			throw ArgumentException("Warm-up needs the whole map, it cannot be used with partition");
 		}
-		return maps.at(map).CalcShortestPath(src);
+		cout << "The Server A is up and running using UDP on port " << port << "." << endl;
 	}
-};
 
-class Connection {
-private:
-	UdpReceiveSocketHelper receiveHelper;
-
-public:
-	Connection() : receiveHelper(UdpReceiveSocketHelper(SERVER_A_PORT)) {
-		cout << "The Server A is up and running using UDP on port " << SERVER_A_PORT << "." << endl;
+	// hot sources of a query log given by --warm-up, before any query is taken
+	void WarmUp(const MapManager& manager, const Options& options) {
+		if (options.Has("warm-up")) {
+			hotSources.Warm(manager, options.Get("warm-up", ""), options.GetInt("warm-sources", DEFAULT_WARM_SOURCES));
+		}
 	}
 
-	void Process(const MapManager& manager)  {
+	// a malformed datagram is dropped, its sender cannot be told
+	void Process(const MapManager& manager) {
 		while (true) {
-			auto query = ClientQuery(receiveHelper);
-			cout << "The Server A has received input for finding shortest paths: starting vertex " << query.sourceNode << " of map " << query.mapName << "." << endl;
-
-			auto shortestPath = manager.CalcShortestPath(query.mapName, query.sourceNode);
-			cout << "The Server A has identified the following shortest paths:" << endl;
-			shortestPath.Print();
-
-			auto sendHelper = receiveHelper.SendHelper(HOST, SERVER_AWS_UDP_PORT);
-			shortestPath.Encode(*sendHelper);
-			cout << "The Server A has sent shortest paths to AWS." << endl;
+			RequestArenaScope arenaScope; // messages of this request are released together at the end of iteration
+			try {
+				ProcessQuery(manager);
+			} catch (const PayloadSizeMismatchException& ex) {
+				std::cerr << ex.what() << endl;
+				receiveHelper->Discard();
+			}
 		}
 	}
 };
 
-int main() {
+int main(int argc, char* argv[]) {
 	try {
-		auto conn = Connection();
-		auto manager = MapManager();
+		auto options = Options(argc, argv);
+		Tracer::Instance().Configure(options, "serverA");
+		if (ParsePartition(options.Get("partition", "0/1")).index > 0) { // serves partition 0 only
+			PartitionWorker worker(options);
+			MapManager manager(options);
+			worker.Serve(manager);
+			return 0;
+		}
+		Connection conn(options.Get("port", SERVER_A_PORT), options);
+		MapManager manager(options);
+		conn.WarmUp(manager, options);
 		conn.Process(manager);
 	} catch (const std::exception & ex) {
 		std::cerr << ex.what() << endl;
@@ -5,6 +5,9 @@
 #include <netdb.h>
 
 #include "common.hpp"
+#include "sharedMemory.hpp"
+#include "delayEngine.hpp"
+#include "trace.hpp"
 
 using std::cout;
 using std::endl;
@@ -21,60 +24,88 @@ using std::endl;
 //                    Class                      //
 //===============================================//
 
-// delay calculation logic
-struct DefaultDelay : public AllDelay {
+class Connection {
 private:
-	static Delay_t CalcTransmissionDelay(const FileSize_t& fileSize, const MapInfo& mapInfo, const Distance_t& distance) {
-		return (double)fileSize / BYTE_SIZE / mapInfo.transmissionSpeed;
+	std::unique_ptr<DatagramReceiveHelper> receiveHelper;
+	DelayInjector delayInjector;
+	AdmissionControl admissionControl;
+
+	static AllDelay Calculate(const ClientQuery& query, const AllShortestPath& shortestPath) {
+		TraceScope span(query.traceId, "server B delay");
+		return DefaultDelay(query.fileSize, shortestPath);
 	}
 
-	static Delay_t CalcPropagationDelay(const MapInfo& mapInfo, const Distance_t& distance) {
-		return distance / mapInfo.propagationSpeed;
+	void Send(const ClientQuery& query, const AllDelay& delay) {
+		TraceScope span(query.traceId, "server B send");
+		auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(query.requestId));
+		delay.Encode(*sendHelper);
 	}
-public:
-	DefaultDelay(const FileSize_t& fileSize, const AllShortestPath& allShortestPath) {
-		for (const auto& record : allShortestPath.distances) {
-			auto t = CalcTransmissionDelay(fileSize, allShortestPath.mapInfo, record.second);
-			auto p = CalcPropagationDelay(allShortestPath.mapInfo, record.second);
-			AddDelay(record.first, Delay(t, p));
+
+	// one query with its shortest paths
+	void ProcessQuery() {
+		auto query = ClientQuery(*receiveHelper); // a query and its shortest paths arrive in one datagram
+		auto shortestPath = AllShortestPath(*receiveHelper);
+		TraceQueued(query, "queue to server B");
+
+		auto admission = admissionControl.Admit(query);
+		if (admission == Status::DeadlineExceeded) { // nobody waits for the result
+			cout << "The Server B has dropped the data since its deadline has passed." << endl;
+			return;
+		}
+		if (admission == Status::Overloaded) { // reject quickly, so that the AWS need not wait
+			auto sendHelper = receiveHelper->SendHelper(HOST, AwsReplyPort(query.requestId));
+			AllDelay(query.requestId, admission).Encode(*sendHelper);
+			cout << "The Server B has rejected the data since it is overloaded." << endl;
+			return;
+		}
+		auto delay = Calculate(query, shortestPath);
+		delay.requestId = query.requestId;
+		if (query.kind == QueryKind::BatchItem) { // tables of every source of a batch would cost more than the calculation
+			delayInjector.Inject();
+			Send(query, delay);
+			return;
+		}
+
+		cout << std::left << std::fixed << std::setprecision(FLOAT_PRECISION);
+		cout << "The Server B has received data for calculation:" << endl;
+		cout << "* Propagation speed: " << shortestPath.mapInfo.propagationSpeed << " km/s;" << endl;
+		cout << "* Transmission speed " << shortestPath.mapInfo.transmissionSpeed << " Bytes/s;" << endl;
+		for (const auto& path : shortestPath.distances) {
+			cout << "* Path length for destination " << path.first << ": " << path.second << ";" << endl;
 		}
+
+		cout << "The Server B has finished the calculation of the delays:" << endl;
+		delay.Print();
+
+		delayInjector.Inject();
+		Send(query, delay);
+		cout << "The Server B has finished sending the output to AWS" << endl;
 	}
-};
 
-class Connection {
-private:
-	UdpReceiveSocketHelper receiveHelper;
 public:
-	Connection() : receiveHelper(UdpReceiveSocketHelper(SERVER_B_PORT)) {
-		std::cout << "The Server B is up and running using UDP on port " << SERVER_B_PORT << "." << std::endl;
+	Connection(const string& port, const Options& options) : receiveHelper(OpenDatagramReceiver(options, port)), delayInjector(options), admissionControl(options) {
+		std::cout << "The Server B is up and running using UDP on port " << port << "." << std::endl;
 	}
 
+	// a malformed datagram is dropped, its sender cannot be told
 	void Process() {
 		while (true) {
-			auto query = ClientQuery(receiveHelper);
-			auto shortestPath = AllShortestPath(receiveHelper);
-			cout << std::left << std::fixed << std::setprecision(FLOAT_PRECISION);
-			cout << "The Server B has received data for calculation:" << endl;
-			cout << "* Propagation speed: " << shortestPath.mapInfo.propagationSpeed << " km/s;" << endl;
-			cout << "* Transmission speed " << shortestPath.mapInfo.transmissionSpeed << " Bytes/s;" << endl;
-			for (const auto& path : shortestPath.distances) {
-				cout << "* Path length for destination " << path.first << ": " << path.second << ";" << endl;
+			RequestArenaScope arenaScope; // messages of this request are released together at the end of iteration
+			try {
+				ProcessQuery();
+			} catch (const PayloadSizeMismatchException& ex) {
+				std::cerr << ex.what() << endl;
+				receiveHelper->Discard();
 			}
-
-			auto delay = DefaultDelay(query.fileSize, shortestPath);
-			cout << "The Server B has finished the calculation of the delays:" << endl;
-			delay.Print();
-
-			auto sendHelper = receiveHelper.SendHelper(HOST, SERVER_AWS_UDP_PORT);
-			delay.Encode(*sendHelper);
-			cout << "The Server B has finished sending the output to AWS" << endl;
 		}
 	}
 };
 
-int main() {
+int main(int argc, char* argv[]) {
 	try {
-		auto conn = Connection();
+		auto options = Options(argc, argv);
+		Tracer::Instance().Configure(options, "serverB");
+		auto conn = Connection(options.Get("port", SERVER_B_PORT), options);
 		conn.Process();
 	} catch (const std::exception & ex) {
 		std::cerr << ex.what() << endl;
@@ -0,0 +1,163 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "common.hpp"
+
+using std::cout;
+using std::endl;
+
+//===============================================//
+//                    Const                      //
+//===============================================//
+
+const char* DEFAULT_OUTPUT = "trace.json";
+
+//===============================================//
+//                    Class                      //
+//===============================================//
+
+class TraceFileException : public EE450Exception {
+public:
+	TraceFileException(const string& path, const string& reason) : EE450Exception("Cannot read trace file " + path + ": " + reason) {}
+};
+
+// span as written by Tracer::Flush, with the process that recorded it
+struct Span {
+	string traceId; // hex
+	int pid;
+	int tid;
+	Timestamp_t start;
+	Timestamp_t end;
+	string name;
+};
+
+// name of a recording process and the spans it dumped
+struct Dump {
+	string process;
+	int pid = 0;
+	size_t dropped = 0;
+	vector<Span> spans;
+};
+
+//===============================================//
+//                     Tool                      //
+//===============================================//
+
+string Quote(const string& str) {
+	string result = "\"";
+	for (const auto c : str) {
+		if (c == '"' || c == '\\') {
+			result.push_back('\\');
+		}
+		if ((unsigned char)c >= 0x20) {
+			result.push_back(c);
+		}
+	}
+	return result + "\"";
+}
+
+// a dump starts with "# process <name> <pid>", then one span per line, "# dropped <count>" when spans were lost
+Dump ReadDump(const string& path, const string& only) {
+	std::ifstream file(path);
+	if (!file) {
+		throw TraceFileException(path, "not found");
+	}
+	Dump dump;
+	string line, mark, word;
+	if (!std::getline(file, line) || !(std::istringstream(line) >> mark >> word >> dump.process >> dump.pid) || mark != "#" || word != "process") {
+		throw TraceFileException(path, "no process header");
+	}
+	while (std::getline(file, line)) {
+		std::istringstream stream(line);
+		if (line.compare(0, 10, "# dropped ") == 0) {
+			auto count = size_t(0);
+			stream.ignore(10) >> count;
+			dump.dropped += count;
+			continue;
+		}
+		Span span;
+		span.pid = dump.pid;
+		if (!(stream >> span.traceId >> span.tid >> span.start >> span.end) || !std::getline(stream >> std::ws, span.name)) {
+			continue; // the last line of a process killed while flushing
+		}
+		if (only.empty() || span.traceId == only) {
+			dump.spans.push_back(span);
+		}
+	}
+	return dump;
+}
+
+// Chrome trace event format, opened by chrome://tracing and ui.perfetto.dev; times are relative to the earliest span
+// spans of one trace are linked by a flow across processes, in order of their start
+void WriteJson(const string& path, const vector<Dump>& dumps) {
+	std::ofstream file(path);
+	if (!file) {
+		throw ArgumentException("Cannot write " + path);
+	}
+	vector<Span> spans;
+	for (const auto& dump : dumps) {
+		spans.insert(spans.end(), dump.spans.begin(), dump.spans.end());
+	}
+	std::stable_sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) {
+		return a.start < b.start;
+	});
+	auto origin = spans.empty() ? 0 : spans.front().start;
+	auto separator = "\n";
+	file << "{\"traceEvents\":[";
+	for (const auto& dump : dumps) {
+		file << separator << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << dump.pid << ",\"args\":{\"name\":" << Quote(dump.process) << "}}";
+		separator = ",\n";
+	}
+	for (const auto& span : spans) {
+		file << separator << "{\"name\":" << Quote(span.name) << ",\"cat\":\"query\",\"ph\":\"X\",\"pid\":" << span.pid << ",\"tid\":" << span.tid
+			<< ",\"ts\":" << span.start - origin << ",\"dur\":" << std::max(Timestamp_t(0), span.end - span.start) << ",\"args\":{\"trace\":" << Quote(span.traceId) << "}}";
+		separator = ",\n";
+	}
+	// a flow step per span that starts the part of a trace in another process or thread
+	map<string, vector<const Span*>> traces;
+	for (const auto& span : spans) {
+		auto& steps = traces[span.traceId];
+		if (steps.empty() || steps.back()->pid != span.pid || steps.back()->tid != span.tid) {
+			steps.push_back(&span);
+		}
+	}
+	auto flowId = 0;
+	for (const auto& trace : traces) {
+		flowId++;
+		const auto& steps = trace.second;
+		for (size_t i = 0; steps.size() > 1 && i < steps.size(); i++) {
+			auto phase = i == 0 ? "s" : i + 1 == steps.size() ? "f" : "t";
+			file << separator << "{\"name\":\"query\",\"cat\":\"query\",\"ph\":\"" << phase << "\",\"bp\":\"e\",\"id\":" << flowId
+				<< ",\"pid\":" << steps[i]->pid << ",\"tid\":" << steps[i]->tid << ",\"ts\":" << steps[i]->start - origin << "}";
+		}
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	cout << "The trace merger has written " << spans.size() << " spans of " << traces.size() << " traces into " << path << "." << endl;
+}
+
+//===============================================//
+//                    Main                       //
+//===============================================//
+
+// ./traceMerge <dump>... [--output=trace.json] [--trace=<trace ID>]
+int main(int argc, char* argv[]) {
+	try {
+		auto options = Options(argc, argv);
+		if (options.Positional().empty()) {
+			throw ArgumentException("Usage: ./traceMerge <dump>... [--output=trace.json] [--trace=<trace ID>]");
+		}
+		vector<Dump> dumps;
+		for (const auto& path : options.Positional()) {
+			dumps.push_back(ReadDump(path, options.Get("trace", "")));
+			if (dumps.back().dropped > 0) {
+				cout << "The " << dumps.back().process << " " << dumps.back().pid << " has dropped " << dumps.back().dropped << " spans." << endl;
+			}
+		}
+		WriteJson(options.Get("output", DEFAULT_OUTPUT), dumps);
+	} catch (const std::exception& ex) {
+		std::cerr << ex.what() << endl;
+	}
+	return 0;
+}
\ No newline at end of file
@@ -7,11 +7,26 @@ rm -rf $folder
 mkdir $folder
 cp README $folder
 cp Makefile $folder
+cp test_split_threshold.sh $folder
 cp Common/common.hpp $folder
+cp Common/awsClient.hpp $folder
+cp Common/mapEngine.hpp $folder
+cp Common/contractionHierarchy.hpp $folder
+cp Common/compressedAdjacency.hpp $folder
+cp Common/delayEngine.hpp $folder
+cp Common/lockFreeQueue.hpp $folder
+cp Common/partition.hpp $folder
+cp Common/queryLog.hpp $folder
+cp Common/sharedMemory.hpp $folder
+cp Common/threadPool.hpp $folder
+cp Common/trace.hpp $folder
 cp Client/client.cpp $folder
 cp MainServer/aws.cpp $folder
 cp ServerA/serverA.cpp $folder
 cp ServerB/serverB.cpp $folder
+cp Benchmark/benchmark.cpp $folder
+cp TraceMerge/traceMerge.cpp $folder
+cp QueryReplay/queryReplay.cpp $folder
 cd $folder
 tar cvf $result *
 gzip $result
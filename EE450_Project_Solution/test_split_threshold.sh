@@ -0,0 +1,43 @@
+# Checks that queries on a map at the parallel threshold are answered in full in the split deployment, and server A survives them.
+# Usage: ./test_split_threshold.sh [folder of the executables built by "make all"], the ports of the servers must be free.
+# The map is a 501 x 501 grid, 1002000 directed edges, so server A searches it by delta-stepping.
+bin=$(cd "${1:-.}" && pwd)
+side=501
+vertices=$((side * side))
+work=$(mktemp -d)
+cd $work
+awk -v side=$side 'BEGIN {
+	print "T"; print "200000"; print "1000000"
+	for (r = 0; r < side; r++) for (c = 0; c < side; c++) {
+		v = r * side + c
+		if (c + 1 < side) print v, v + 1, 1 + (v * 7) % 13
+		if (r + 1 < side) print v, v + side, 1 + (v * 11) % 17
+	}
+}' > map.txt
+$bin/serverA > serverA.log 2>&1 &
+serverA=$!
+$bin/serverB > serverB.log 2>&1 &
+$bin/aws --reply-timeout-ms=120000 > aws.log 2>&1 &
+sleep 1
+failures=0
+check() {
+	if [ "$2" = "$3" ]; then
+		echo "PASS $1"
+	else
+		echo "FAIL $1: expected $3, got $2"
+		failures=$((failures + 1))
+	fi
+}
+rows() {
+	timeout 120 $bin/client T "$@" | grep -c '^[0-9]'
+}
+check "unbounded query" $(rows 0 1000) $((vertices - 1))
+check "server A is still running" $(kill -0 $serverA 2> /dev/null && echo yes || echo no) yes
+check "bounded query" $(rows 0 1000 --k=5) 5
+check "stream" $(rows 0 1000 --stream) $((vertices - 1))
+check "server A is still running" $(kill -0 $serverA 2> /dev/null && echo yes || echo no) yes
+kill $(jobs -p) 2> /dev/null
+wait 2> /dev/null
+cd /
+rm -rf $work
+[ $failures -eq 0 ]